@@ -0,0 +1,450 @@
+/*============================================================================
+  
+    pi-servo
+
+    bench.c
+
+    A benchmark for the PWM backends. For each backend asked for, run N
+    channels at F Hz for a while, and report the CPU used, the number of
+    system calls made, and the edge timing from the PWM statistics, as
+    one JSON object per line. With -m, also search for the highest 
+    frequency at which the backend keeps up.
+
+    Usage: pwm-bench [-b backends] [-n channels] [-f hz] [-t seconds]
+                     [-P pins] [-s] [-m]
+
+    -b  comma-separated list of sysfs, gpiomem, chardev, dma, sim 
+        (default: all five)
+    -n  number of channels (default 1)
+    -f  PWM frequency in Hz (default 50)
+    -t  seconds to run each test for (default 5)
+    -P  comma-separated GPIO pins to use (default: the free GPIOs on the
+        40-pin header, 4, 5, 6, 12, 13, 16... 27)
+    -s  give each channel its own timing thread, rather than using one
+        engine for all of them. DMA channels never use an engine
+    -m  find the maximum sustainable frequency, as well
+
+    A run is "sustainable" if no more than one edge in a thousand was an
+    overrun. System calls are counted with the raw_syscalls:sys_enter
+    tracepoint, which needs tracefs and, usually, root; if it can't be 
+    opened, "syscalls" is null. DMA channels have no timing thread, so 
+    no edge statistics. The sim backend needs no hardware at all, so it
+    measures the timing threads by themselves.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_engine.h" 
+
+// Below this cycle length the search for the maximum frequency gives up
+#define BENCH_MIN_CYCLE_USEC 20
+
+// Seconds for each step of the maximum-frequency search
+#define BENCH_SEARCH_SECONDS 1.0
+
+static const int bench_default_pins[] = 
+  { 4, 5, 6, 12, 13, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27 };
+
+typedef struct _BenchConfig
+  {
+  PWMBackend backend;
+  int channels;
+  const int *pins;
+  int freq_hz;
+  double seconds;
+  BOOL engine; // One engine for all channels, rather than a thread each
+  } BenchConfig;
+
+typedef struct _BenchResult
+  {
+  BOOL started;
+  char error[256];
+  double cpu_pct; // Of one CPU, over the run
+  long long syscalls; // Or -1 if they couldn't be counted
+  unsigned long cycles; // Summed over all channels
+  unsigned long edges;
+  unsigned long overruns;
+  // Worst channel's figures
+  int64_t p50_late_ns;
+  int64_t p99_late_ns;
+  int64_t max_late_ns;
+  BOOL has_stats;
+  BOOL sustainable;
+  } BenchResult;
+
+/*============================================================================
+  bench_backend_name
+============================================================================*/
+static const char *bench_backend_name (PWMBackend backend)
+  {
+  switch (backend)
+    {
+    case PWM_BACKEND_SYSFS: return "sysfs";
+    case PWM_BACKEND_GPIOMEM: return "gpiomem";
+    case PWM_BACKEND_DMA: return "dma";
+    case PWM_BACKEND_HWPWM: return "hwpwm";
+    case PWM_BACKEND_CHARDEV: return "chardev";
+    case PWM_BACKEND_SIM: return "sim";
+    default: return "auto";
+    }
+  }
+
+/*============================================================================
+  bench_parse_backend
+============================================================================*/
+static BOOL bench_parse_backend (const char *name, PWMBackend *backend)
+  {
+  static const PWMBackend all[] = { PWM_BACKEND_SYSFS, PWM_BACKEND_GPIOMEM,
+    PWM_BACKEND_CHARDEV, PWM_BACKEND_DMA, PWM_BACKEND_SIM };
+  for (size_t i = 0; i < sizeof (all) / sizeof (all[0]); i++)
+    {
+    if (strcmp (name, bench_backend_name (all[i])) == 0)
+      {
+      *backend = all[i];
+      return TRUE;
+      }
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  bench_open_syscall_counter
+
+  Open a counter of system calls made by this process, including by 
+  threads it creates from now on. Returns the fd, or -1.
+
+============================================================================*/
+static int bench_open_syscall_counter (void)
+  {
+  static const char *ids[] = {
+    "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+    "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id" };
+  long long id = -1;
+  for (size_t i = 0; i < sizeof (ids) / sizeof (ids[0]) && id < 0; i++)
+    {
+    FILE *f = fopen (ids[i], "r");
+    if (f)
+      {
+      if (fscanf (f, "%lld", &id) != 1) id = -1;
+      fclose (f);
+      }
+    }
+  if (id < 0) return -1;
+
+  struct perf_event_attr attr;
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = PERF_TYPE_TRACEPOINT;
+  attr.config = id;
+  attr.inherit = 1; // Count the timing threads, too
+  attr.exclude_kernel = 0;
+  return (int)syscall (SYS_perf_event_open, &attr, 0, -1, -1, 
+    PERF_FLAG_FD_CLOEXEC);
+  }
+
+/*============================================================================
+  bench_cpu_usec
+
+  User plus system time used by the whole process so far, including
+  threads that have exited.
+
+============================================================================*/
+static long long bench_cpu_usec (void)
+  {
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL
+    + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  }
+
+/*============================================================================
+  bench_wall_usec
+============================================================================*/
+static long long bench_wall_usec (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+  }
+
+/*============================================================================
+  bench_run
+
+  Run one test. The counters are started before any PWM is, and read 
+  after they have all been stopped and their threads joined, so that 
+  the threads' system calls and CPU time have been folded into the 
+  process's.
+
+============================================================================*/
+static void bench_run (const BenchConfig *config, BenchResult *result)
+  {
+  memset (result, 0, sizeof (BenchResult));
+  result->syscalls = -1;
+
+  int cycle_usec = 1000000 / config->freq_hz;
+  BOOL engine = config->engine && config->backend != PWM_BACKEND_DMA
+    && config->channels <= PWM_ENGINE_MAX_CHANNELS;
+  PWM *pwms[PWM_POOL_SIZE];
+  int n = 0;
+  PWMOptions options;
+  pwm_options_init (&options);
+  options.error_buf = result->error;
+  options.error_size = sizeof (result->error);
+
+  int counter = bench_open_syscall_counter ();
+  long long cpu_start = bench_cpu_usec ();
+  long long wall_start = bench_wall_usec ();
+
+  for (n = 0; n < config->channels; n++)
+    {
+    pwms[n] = pwm_pool_create (config->pins[n], config->backend);
+    if (!pwms[n])
+      {
+      snprintf (result->error, sizeof (result->error), 
+        "More than %d channels", PWM_POOL_SIZE);
+      break;
+      }
+    }
+
+  PWMEngine *e = NULL;
+  BOOL started = (n == config->channels);
+  if (started && engine)
+    {
+    e = pwm_engine_create (cycle_usec);
+    pwm_engine_set_phase_mode (e, PWM_PHASE_STAGGER);
+    for (int i = 0; i < n; i++)
+      pwm_engine_add (e, pwms[i]);
+    started = pwm_engine_start_with_options (e, &options, NULL);
+    }
+  else if (started)
+    {
+    for (int i = 0; i < n && started; i++)
+      started = pwm_start_with_options (pwms[i], cycle_usec, &options, NULL);
+    }
+
+  if (started)
+    {
+    for (int i = 0; i < n; i++)
+      pwm_set_duty_q16 (pwms[i], PWM_DUTY_Q16_ONE / 2);
+    usleep ((useconds_t)(config->seconds * 1000000));
+    }
+
+  if (e) pwm_engine_destroy (e);
+  long long wall = bench_wall_usec () - wall_start;
+
+  for (int i = 0; i < n; i++)
+    {
+    PWMStats stats;
+    pwm_get_stats (pwms[i], &stats);
+    result->cycles += stats.cycles;
+    result->edges += stats.edges;
+    result->overruns += stats.overruns;
+    if (stats.edges > 0)
+      {
+      result->has_stats = TRUE;
+      if (stats.p50_late_ns > result->p50_late_ns) 
+        result->p50_late_ns = stats.p50_late_ns;
+      if (stats.p99_late_ns > result->p99_late_ns) 
+        result->p99_late_ns = stats.p99_late_ns;
+      if (stats.max_late_ns > result->max_late_ns) 
+        result->max_late_ns = stats.max_late_ns;
+      }
+    pwm_destroy (pwms[i]);
+    }
+
+  result->cpu_pct = wall > 0 
+    ? 100.0 * (bench_cpu_usec () - cpu_start) / wall : 0.0;
+  if (counter >= 0)
+    {
+    long long count;
+    if (read (counter, &count, sizeof (count)) == sizeof (count))
+      result->syscalls = count;
+    close (counter);
+    }
+  result->started = started;
+  result->sustainable = started 
+    && (!result->has_stats || result->overruns * 1000 <= result->edges);
+  }
+
+/*============================================================================
+  bench_print
+============================================================================*/
+static void bench_print (const BenchConfig *config, const BenchResult *r)
+  {
+  printf ("{\"backend\":\"%s\",\"channels\":%d,\"freq_hz\":%d,"
+    "\"seconds\":%.1f,\"engine\":%s", bench_backend_name (config->backend),
+    config->channels, config->freq_hz, config->seconds, 
+    config->engine && config->backend != PWM_BACKEND_DMA ? "true" : "false");
+  if (!r->started)
+    {
+    printf (",\"error\":\"");
+    for (const char *s = r->error; *s; s++)
+      printf (*s == '"' || *s == '\\' ? "\\%c" : "%c", *s);
+    printf ("\"}\n");
+    return;
+    }
+  printf (",\"cpu_pct\":%.2f", r->cpu_pct);
+  if (r->syscalls >= 0)
+    printf (",\"syscalls\":%lld,\"syscalls_per_sec\":%.1f", r->syscalls,
+      r->syscalls / config->seconds);
+  else
+    printf (",\"syscalls\":null,\"syscalls_per_sec\":null");
+  printf (",\"cycles\":%lu,\"edges\":%lu,\"overruns\":%lu", r->cycles,
+    r->edges, r->overruns);
+  if (r->has_stats)
+    printf (",\"p50_late_ns\":%lld,\"p99_late_ns\":%lld,\"max_late_ns\":%lld",
+      (long long)r->p50_late_ns, (long long)r->p99_late_ns, 
+      (long long)r->max_late_ns);
+  else
+    printf (",\"p50_late_ns\":null,\"p99_late_ns\":null,"
+      "\"max_late_ns\":null");
+  printf (",\"sustainable\":%s}\n", r->sustainable ? "true" : "false");
+  fflush (stdout);
+  }
+
+/*============================================================================
+  bench_max_freq
+
+  Double the frequency until the backend can't keep up, then bisect 
+  between the last good and first bad frequencies. Returns the highest
+  sustainable frequency found, or 0 if not even the starting one is.
+
+============================================================================*/
+static int bench_max_freq (const BenchConfig *base)
+  {
+  BenchConfig config = *base;
+  BenchResult result;
+  config.seconds = BENCH_SEARCH_SECONDS;
+  int max_hz = 1000000 / BENCH_MIN_CYCLE_USEC;
+  int good = 0, bad = 0;
+  for (int hz = base->freq_hz; hz <= max_hz; hz *= 2)
+    {
+    config.freq_hz = hz;
+    bench_run (&config, &result);
+    if (!result.sustainable) 
+      {
+      bad = hz;
+      break;
+      }
+    good = hz;
+    }
+  if (good == 0) return 0;
+  if (bad == 0) return good; // Kept up all the way
+  while (bad - good > good / 20 + 1)
+    {
+    config.freq_hz = good + (bad - good) / 2;
+    bench_run (&config, &result);
+    if (result.sustainable)
+      good = config.freq_hz;
+    else
+      bad = config.freq_hz;
+    }
+  return good;
+  }
+
+/*============================================================================
+  bench_parse_pins
+============================================================================*/
+static int bench_parse_pins (char *list, int *pins, int max)
+  {
+  int n = 0;
+  for (char *tok = strtok (list, ","); tok && n < max; 
+       tok = strtok (NULL, ","))
+    pins[n++] = atoi (tok);
+  return n;
+  }
+
+/*============================================================================
+  main
+============================================================================*/
+int main (int argc, char **argv)
+  {
+  PWMBackend backends[5] = { PWM_BACKEND_SYSFS, PWM_BACKEND_GPIOMEM,
+    PWM_BACKEND_CHARDEV, PWM_BACKEND_DMA, PWM_BACKEND_SIM };
+  int num_backends = 5;
+  int pins[PWM_POOL_SIZE];
+  int num_pins = sizeof (bench_default_pins) / sizeof (bench_default_pins[0]);
+  memcpy (pins, bench_default_pins, sizeof (bench_default_pins));
+  BenchConfig config;
+  memset (&config, 0, sizeof (config));
+  config.channels = 1;
+  config.freq_hz = 50;
+  config.seconds = 5.0;
+  config.engine = TRUE;
+  config.pins = pins;
+  BOOL search = FALSE;
+
+  int opt;
+  while ((opt = getopt (argc, argv, "b:n:f:t:P:sm")) != -1)
+    {
+    switch (opt)
+      {
+      case 'b':
+        num_backends = 0;
+        for (char *tok = strtok (optarg, ","); tok && num_backends < 5; 
+             tok = strtok (NULL, ","))
+          {
+          if (!bench_parse_backend (tok, &backends[num_backends++]))
+            {
+            fprintf (stderr, "Unknown backend: %s\n", tok);
+            return 1;
+            }
+          }
+        break;
+      case 'n': config.channels = atoi (optarg); break;
+      case 'f': config.freq_hz = atoi (optarg); break;
+      case 't': config.seconds = atof (optarg); break;
+      case 'P': num_pins = bench_parse_pins (optarg, pins, PWM_POOL_SIZE); 
+        break;
+      case 's': config.engine = FALSE; break;
+      case 'm': search = TRUE; break;
+      default:
+        fprintf (stderr, "Usage: %s [-b backends] [-n channels] [-f hz] "
+          "[-t seconds] [-P pins] [-s] [-m]\n", argv[0]);
+        return 1;
+      }
+    }
+  if (config.channels < 1 || config.channels > num_pins)
+    {
+    fprintf (stderr, "Channels must be 1-%d, one per pin\n", num_pins);
+    return 1;
+    }
+  if (config.freq_hz < 1 || config.freq_hz > 1000000 / BENCH_MIN_CYCLE_USEC)
+    {
+    fprintf (stderr, "Frequency must be 1-%d Hz\n", 
+      1000000 / BENCH_MIN_CYCLE_USEC);
+    return 1;
+    }
+
+  for (int i = 0; i < num_backends; i++)
+    {
+    BenchResult result;
+    config.backend = backends[i];
+    bench_run (&config, &result);
+    bench_print (&config, &result);
+    if (search && result.started)
+      {
+      printf ("{\"backend\":\"%s\",\"channels\":%d,\"engine\":%s,"
+        "\"max_freq_hz\":%d}\n", bench_backend_name (config.backend), 
+        config.channels, config.engine && config.backend != PWM_BACKEND_DMA
+        ? "true" : "false", bench_max_freq (&config));
+      fflush (stdout);
+      }
+    }
+  return 0;
+  }
+
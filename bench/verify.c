@@ -0,0 +1,447 @@
+/*============================================================================
+
+    pi-servo
+
+    verify.c
+
+    A loopback test of what a PWM backend really puts on the pin. With
+    the output pin wired to an input pin by a jumper, drive the output,
+    have the kernel timestamp every edge that arrives on the input, and
+    compare the measured periods and pulse widths with what was asked
+    for. The PWM statistics only say when the timing thread wrote each
+    edge; this sees the edges themselves, so it also catches the delay
+    between the write and the pin changing, and any edges that never
+    made it out. Results are one JSON object per on-time, as pwm-bench
+    prints them.
+
+    Usage: pwm-verify -o out_pin -i in_pin [-b backend] [-f hz]
+                      [-u on_usecs] [-t seconds] [-r priority] [-S] [-e]
+                      [-j limit_usec]
+
+    -o  GPIO pin that the PWM drives
+    -i  GPIO pin that it is wired to, to read the edges from
+    -b  one of sysfs, gpiomem, chardev, dma, hwpwm, sim (default: the
+        library's choice)
+    -f  PWM frequency in Hz (default 50)
+    -u  comma-separated on-times, in usec, to test in turn (default: a
+        quarter of the cycle)
+    -t  seconds to measure each on-time for (default 5)
+    -r  SCHED_FIFO priority for the timing thread (default 0, normal
+        scheduling)
+    -S  busy-wait for each edge (PWM_TIMING_SPIN), rather than sleep
+    -e  drive the pin from a PWMEngine, as the daemon does
+    -j  fail, with exit status 2, if any period or pulse width is more
+        than this many usec out, or any edge was lost
+
+    Periods are measured from rising edge to rising edge, and widths from
+    a rising edge to the next falling one. The kernel's timestamp is
+    taken in its GPIO interrupt handler, so interrupt latency on the Pi
+    itself shows up as jitter here, too, but it is usually a few usec
+    at most -- much less than a timing thread's. "lost_edges" counts
+    edges that the kernel dropped because its queue was full, and those
+    it never saw because two came too close together; the cycles around
+    them are not measured.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include "defs.h"
+#include "pwm.h"
+#include "pwm_engine.h"
+#include "pwm_time.h"
+#include "gpiochip.h"
+
+// Time to let the output settle at a new on-time before measuring
+#define VERIFY_SETTLE_USEC 100000
+
+// Edges to read from the kernel at a time
+#define VERIFY_READ_EDGES 64
+
+// Measurements of one kind, in nsec
+typedef struct _VerifySeries
+  {
+  int64_t *ns;
+  int n;
+  int max;
+  } VerifySeries;
+
+// Summary of a VerifySeries, against the value that was asked for
+typedef struct _VerifySummary
+  {
+  int n;
+  double mean_ns;
+  double stddev_ns;
+  int64_t min_ns;
+  int64_t max_ns;
+  int64_t p99_err_ns; // 99th percentile of the distance from the target
+  int64_t max_err_ns;
+  } VerifySummary;
+
+typedef struct _VerifyResult
+  {
+  BOOL started;
+  char error[256];
+  VerifySummary periods;
+  VerifySummary widths;
+  unsigned long edges;
+  unsigned long lost_edges;
+  PWMStats stats; // The timing thread's view of the same run
+  } VerifyResult;
+
+/*============================================================================
+  verify_parse_backend
+============================================================================*/
+static BOOL verify_parse_backend (const char *name, PWMBackend *backend)
+  {
+  static const char *const names[] =
+    { "sysfs", "gpiomem", "dma", "hwpwm", "chardev", "sim" };
+  static const PWMBackend all[] = { PWM_BACKEND_SYSFS, PWM_BACKEND_GPIOMEM,
+    PWM_BACKEND_DMA, PWM_BACKEND_HWPWM, PWM_BACKEND_CHARDEV,
+    PWM_BACKEND_SIM };
+  for (size_t i = 0; i < sizeof (all) / sizeof (all[0]); i++)
+    {
+    if (strcmp (name, names[i]) == 0)
+      {
+      *backend = all[i];
+      return TRUE;
+      }
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  verify_compare
+============================================================================*/
+static int verify_compare (const void *a, const void *b)
+  {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return x < y ? -1 : x > y;
+  }
+
+/*============================================================================
+  verify_add
+============================================================================*/
+static void verify_add (VerifySeries *series, int64_t ns)
+  {
+  if (series->n < series->max) series->ns[series->n++] = ns;
+  }
+
+/*============================================================================
+  verify_summarize
+
+  Summarize the series, which is overwritten in the process.
+
+============================================================================*/
+static void verify_summarize (VerifySeries *series, int64_t target_ns,
+    VerifySummary *summary)
+  {
+  memset (summary, 0, sizeof (VerifySummary));
+  int n = series->n;
+  summary->n = n;
+  if (n == 0) return;
+
+  double sum = 0, sum_sq = 0;
+  summary->min_ns = summary->max_ns = series->ns[0];
+  for (int i = 0; i < n; i++)
+    {
+    int64_t ns = series->ns[i];
+    sum += ns;
+    sum_sq += (double)ns * ns;
+    if (ns < summary->min_ns) summary->min_ns = ns;
+    if (ns > summary->max_ns) summary->max_ns = ns;
+    series->ns[i] = llabs (ns - target_ns);
+    }
+  summary->mean_ns = sum / n;
+  double var = sum_sq / n - summary->mean_ns * summary->mean_ns;
+  summary->stddev_ns = var > 0 ? sqrt (var) : 0;
+
+  qsort (series->ns, n, sizeof (int64_t), verify_compare);
+  summary->p99_err_ns = series->ns[(n - 1) * 99 / 100];
+  summary->max_err_ns = series->ns[n - 1];
+  }
+
+/*============================================================================
+  verify_capture
+
+  Read the input's edges for the given time, and turn them into periods
+  and widths. Only whole, unbroken cycles are measured: after a lost
+  edge, measuring starts again at the next rising edge.
+
+============================================================================*/
+static BOOL verify_capture (GpioLines *lines, double seconds,
+    VerifySeries *periods, VerifySeries *widths, VerifyResult *result)
+  {
+  int64_t end = pwm_time_now () + (int64_t)(seconds * 1e9);
+  int64_t last_rise = -1;
+  int last_level = -1;
+  unsigned last_seqno = 0;
+  GpioEdge edges[VERIFY_READ_EDGES];
+
+  while (pwm_time_now () < end)
+    {
+    int n = gpiochip_read_edges (lines, edges, VERIFY_READ_EDGES, 100);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      snprintf (result->error, sizeof (result->error),
+        "Can't read edges: %s", strerror (errno));
+      return FALSE;
+      }
+    for (int i = 0; i < n; i++)
+      {
+      const GpioEdge *edge = &edges[i];
+      if (edge->time_ns > end) break;
+      result->edges++;
+
+      // A gap in the sequence numbers, or two edges the same way, means
+      //  edges are missing in between
+      unsigned lost = last_seqno ? edge->seqno - last_seqno - 1 : 0;
+      if (lost == 0 && edge->level == last_level) lost = 1;
+      last_seqno = edge->seqno;
+      last_level = edge->level;
+      if (lost)
+        {
+        result->lost_edges += lost;
+        last_rise = -1;
+        }
+
+      if (edge->level)
+        {
+        if (last_rise >= 0) verify_add (periods, edge->time_ns - last_rise);
+        last_rise = edge->time_ns;
+        }
+      else if (last_rise >= 0)
+        verify_add (widths, edge->time_ns - last_rise);
+      }
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  verify_run
+
+  Measure one on-time. The PWM is already running, and is left running.
+
+============================================================================*/
+static void verify_run (PWM *pwm, int in_pin, int cycle_usec, int on_usec,
+    double seconds, VerifyResult *result)
+  {
+  memset (result, 0, sizeof (VerifyResult));
+  pwm_set_pulse_usec (pwm, on_usec);
+  usleep (VERIFY_SETTLE_USEC + 2 * cycle_usec);
+
+  // Room for half as many cycles again as there should be, in case the
+  //  input is picking up something other than the PWM
+  VerifySeries periods, widths;
+  periods.max = widths.max = (int)(seconds * 1e6 / cycle_usec * 1.5) + 16;
+  periods.n = widths.n = 0;
+  periods.ns = malloc (periods.max * sizeof (int64_t));
+  widths.ns = malloc (widths.max * sizeof (int64_t));
+
+  // The lines are requested only now, so that no edges from before the
+  //  settling time are queued
+  GpioLines *lines = gpiochip_request_edges (&in_pin, 1);
+  if (lines)
+    {
+    pwm_reset_stats (pwm);
+    result->started = verify_capture (lines, seconds, &periods, &widths,
+      result);
+    pwm_get_stats (pwm, &result->stats);
+    gpiochip_release (lines);
+    }
+  else
+    snprintf (result->error, sizeof (result->error),
+      "Can't watch GPIO %d for edges: %s", in_pin, strerror (errno));
+
+  verify_summarize (&periods, cycle_usec * 1000LL, &result->periods);
+  verify_summarize (&widths, on_usec * 1000LL, &result->widths);
+  free (periods.ns);
+  free (widths.ns);
+  }
+
+/*============================================================================
+  verify_print_summary
+============================================================================*/
+static void verify_print_summary (const char *name, const VerifySummary *s)
+  {
+  printf (",\"%s\":%d", name, s->n);
+  if (s->n)
+    printf (",\"%s_mean_ns\":%.1f,\"%s_stddev_ns\":%.1f,\"%s_min_ns\":%lld,"
+      "\"%s_max_ns\":%lld,\"%s_p99_err_ns\":%lld,\"%s_max_err_ns\":%lld",
+      name, s->mean_ns, name, s->stddev_ns, name, (long long)s->min_ns,
+      name, (long long)s->max_ns, name, (long long)s->p99_err_ns,
+      name, (long long)s->max_err_ns);
+  }
+
+/*============================================================================
+  verify_print
+============================================================================*/
+static void verify_print (PWM *pwm, int out_pin, int in_pin, int cycle_usec,
+    int on_usec, double seconds, const VerifyResult *r, int limit_usec,
+    BOOL pass)
+  {
+  static const char *const names[] =
+    { "sysfs", "gpiomem", "dma", "hwpwm", "chardev", "sim", "auto" };
+  printf ("{\"backend\":\"%s\",\"out_pin\":%d,\"in_pin\":%d,"
+    "\"cycle_usec\":%d,\"on_usec\":%d,\"seconds\":%.1f",
+    names[pwm_get_backend (pwm)], out_pin, in_pin, cycle_usec, on_usec,
+    seconds);
+  if (!r->started)
+    {
+    printf (",\"error\":\"");
+    for (const char *s = r->error; *s; s++)
+      printf (*s == '"' || *s == '\\' ? "\\%c" : "%c", *s);
+    printf ("\"}\n");
+    fflush (stdout);
+    return;
+    }
+  printf (",\"edges\":%lu,\"lost_edges\":%lu", r->edges, r->lost_edges);
+  verify_print_summary ("periods", &r->periods);
+  verify_print_summary ("widths", &r->widths);
+  if (r->stats.edges > 0)
+    printf (",\"sched_p99_late_ns\":%lld,\"sched_overruns\":%lu",
+      (long long)r->stats.p99_late_ns, r->stats.overruns);
+  else
+    printf (",\"sched_p99_late_ns\":null,\"sched_overruns\":null");
+  if (limit_usec >= 0)
+    printf (",\"pass\":%s", pass ? "true" : "false");
+  printf ("}\n");
+  fflush (stdout);
+  }
+
+/*============================================================================
+  main
+============================================================================*/
+int main (int argc, char **argv)
+  {
+  int out_pin = -1, in_pin = -1;
+  PWMBackend backend = PWM_BACKEND_AUTO;
+  int freq_hz = 50;
+  char *on_list = NULL;
+  double seconds = 5.0;
+  int limit_usec = -1;
+  BOOL use_engine = FALSE;
+  PWMOptions options;
+  pwm_options_init (&options);
+
+  int opt;
+  while ((opt = getopt (argc, argv, "o:i:b:f:u:t:r:Sej:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'o': out_pin = atoi (optarg); break;
+      case 'i': in_pin = atoi (optarg); break;
+      case 'b':
+        if (!verify_parse_backend (optarg, &backend))
+          {
+          fprintf (stderr, "Unknown backend: %s\n", optarg);
+          return 1;
+          }
+        break;
+      case 'f': freq_hz = atoi (optarg); break;
+      case 'u': on_list = optarg; break;
+      case 't': seconds = atof (optarg); break;
+      case 'r': options.rt_priority = atoi (optarg); break;
+      case 'S': options.timing = PWM_TIMING_SPIN; break;
+      case 'e': use_engine = TRUE; break;
+      case 'j': limit_usec = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s -o out_pin -i in_pin [-b backend] "
+          "[-f hz] [-u on_usecs] [-t seconds] [-r priority] [-S] [-e] "
+          "[-j limit_usec]\n", argv[0]);
+        return 1;
+      }
+    }
+  if (out_pin < 0 || out_pin >= GPIOCHIP_MAX_LINES || in_pin < 0
+      || in_pin >= GPIOCHIP_MAX_LINES || in_pin == out_pin)
+    {
+    fprintf (stderr, "Give different output and input pins, 0-%d\n",
+      GPIOCHIP_MAX_LINES - 1);
+    return 1;
+    }
+  if (freq_hz < 1 || freq_hz > 100000)
+    {
+    fprintf (stderr, "Frequency must be 1-100000 Hz\n");
+    return 1;
+    }
+  if (seconds <= 0)
+    {
+    fprintf (stderr, "Seconds must be more than zero\n");
+    return 1;
+    }
+  int cycle_usec = 1000000 / freq_hz;
+
+  // Check all the on-times before driving anything. Fully on and fully
+  //  off have no edges to measure
+  int on_usecs[64];
+  int num_on = 0;
+  if (on_list)
+    {
+    for (char *tok = strtok (on_list, ","); tok; tok = strtok (NULL, ","))
+      {
+      int on_usec = atoi (tok);
+      if (num_on == 64 || on_usec <= 0 || on_usec >= cycle_usec)
+        {
+        fprintf (stderr, "On-times must be 1-%d usec, and at most 64 of "
+          "them\n", cycle_usec - 1);
+        return 1;
+        }
+      on_usecs[num_on++] = on_usec;
+      }
+    }
+  else
+    on_usecs[num_on++] = cycle_usec / 4 > 0 ? cycle_usec / 4 : 1;
+
+  PWM *pwm = pwm_create_backend (out_pin, backend);
+  PWMEngine *engine = NULL;
+  char *error = NULL;
+  BOOL started;
+  if (use_engine)
+    {
+    engine = pwm_engine_create (cycle_usec);
+    started = pwm_engine_add (engine, pwm)
+      && pwm_engine_start_with_options (engine, &options, &error);
+    }
+  else
+    started = pwm_start_with_options (pwm, cycle_usec, &options, &error);
+  if (!started)
+    {
+    fprintf (stderr, "Can't start PWM on GPIO %d: %s\n", out_pin,
+      error ? error : "can't add it to an engine");
+    free (error);
+    if (engine) pwm_engine_destroy (engine);
+    pwm_destroy (pwm);
+    return 1;
+    }
+
+  int ret = 0;
+  for (int i = 0; i < num_on; i++)
+    {
+    VerifyResult result;
+    verify_run (pwm, in_pin, cycle_usec, on_usecs[i], seconds, &result);
+    int64_t limit_ns = limit_usec * 1000LL;
+    BOOL pass = result.started && result.periods.n > 0
+      && result.widths.n > 0 && result.lost_edges == 0
+      && result.periods.max_err_ns <= limit_ns
+      && result.widths.max_err_ns <= limit_ns;
+    verify_print (pwm, out_pin, in_pin, cycle_usec, on_usecs[i], seconds,
+      &result, limit_usec, pass);
+    if (!result.started)
+      ret = 1;
+    else if (limit_usec >= 0 && !pass && ret == 0)
+      ret = 2;
+    }
+
+  if (engine) pwm_engine_destroy (engine);
+  pwm_destroy (pwm);
+  return ret;
+  }
+
@@ -0,0 +1,309 @@
+/*==========================================================================
+  
+    batch.c
+
+    The batch command stream. Text commands are separated by whitespace,
+    commas or semicolons, so a host can send one per line, or many per 
+    line:
+
+    17=0.075     set GPIO 17 to a duty of 0.075 (of the cycle)
+    18:1500      set GPIO 18 to an on-time of 1500 usec
+
+    Duties are parsed straight into 16.16 fixed point, and on-times into
+    integers, so no floating point is involved anywhere between the read
+    and the store into the PWM. Binary mode reads BatchRecords instead,
+    which needs no parsing at all.
+
+    Since the PWM setters are lock-free stores, there's nothing to gain
+    from queueing updates: each read() is parsed and applied at once, 
+    however many commands it holds, and the timing thread picks up the 
+    new values at the start of its next cycle.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "batch.h" 
+
+// Longest text command we'll hold over between reads. Anything longer 
+//  can't be valid
+#define BATCH_MAX_TOKEN 32
+
+// Bytes to read from the fd at a time
+#define BATCH_READ_SIZE 65536
+
+struct _Batch
+  {
+  PWM *pwms[BATCH_MAX_PIN + 1];
+  BOOL binary;
+  char partial[BATCH_MAX_TOKEN > sizeof (BatchRecord) 
+    ? BATCH_MAX_TOKEN : sizeof (BatchRecord)];
+  size_t partial_len; // Bytes of an incomplete command held over
+  BOOL overlong; // Set while skipping the rest of a too-long token
+  unsigned long errors;
+  char buf[BATCH_READ_SIZE]; // For batch_run_fd()
+  };
+
+/*============================================================================
+  batch_create
+============================================================================*/
+Batch *batch_create (PWM *const *pwms, BOOL binary)
+  {
+  Batch *self = malloc (sizeof (Batch));
+  memset (self, 0, sizeof (Batch));
+  memcpy (self->pwms, pwms, sizeof (self->pwms));
+  self->binary = binary;
+  return self;
+  }
+
+/*============================================================================
+  batch_destroy
+============================================================================*/
+void batch_destroy (Batch *self)
+  {
+  free (self);
+  }
+
+/*============================================================================
+  batch_get_errors
+============================================================================*/
+unsigned long batch_get_errors (const Batch *self)
+  {
+  assert (self != NULL);
+  return self->errors;
+  }
+
+/*============================================================================
+  batch_apply
+============================================================================*/
+static BOOL batch_apply (Batch *self, unsigned pin, int kind, uint32_t value)
+  {
+  if (pin > BATCH_MAX_PIN || !self->pwms[pin]) return FALSE;
+  if (kind == BATCH_KIND_PULSE_USEC)
+    pwm_set_pulse_usec (self->pwms[pin], value > INT32_MAX 
+      ? INT32_MAX : (int)value);
+  else if (kind == BATCH_KIND_DUTY_Q16)
+    pwm_set_duty_q16 (self->pwms[pin], value);
+  else
+    return FALSE;
+  return TRUE;
+  }
+
+/*============================================================================
+  batch_parse_q16
+
+  Parse a non-negative decimal, like "0.075" or "1", as 16.16 fixed 
+  point, rounded to nearest. Returns FALSE if it isn't one.
+
+============================================================================*/
+static BOOL batch_parse_q16 (const char *s, const char *end, uint32_t *q16)
+  {
+  uint64_t whole = 0;
+  const char *p = s;
+  while (p < end && *p >= '0' && *p <= '9')
+    {
+    whole = whole * 10 + (*p++ - '0');
+    if (whole > 1) return FALSE; // Won't be a duty
+    }
+  // Up to nine fraction digits, scaled as an integer of 1e-9 units
+  uint64_t frac = 0, scale = 1000000000;
+  if (p < end && *p == '.')
+    {
+    p++;
+    while (p < end && *p >= '0' && *p <= '9')
+      {
+      if (scale > 1)
+        {
+        scale /= 10;
+        frac += (uint64_t)(*p - '0') * scale;
+        }
+      p++;
+      }
+    }
+  if (p != end || p == s) return FALSE;
+  *q16 = (uint32_t)(whole * PWM_DUTY_Q16_ONE 
+    + (frac * PWM_DUTY_Q16_ONE + 500000000) / 1000000000);
+  return TRUE;
+  }
+
+/*============================================================================
+  batch_parse_token
+
+  Apply one text command, "pin=duty" or "pin:usec".
+
+============================================================================*/
+static BOOL batch_parse_token (Batch *self, const char *s, const char *end)
+  {
+  unsigned pin = 0;
+  const char *p = s;
+  while (p < end && *p >= '0' && *p <= '9' && pin <= BATCH_MAX_PIN)
+    pin = pin * 10 + (*p++ - '0');
+  if (p == s || p == end) return FALSE;
+  char op = *p++;
+  if (op == '=')
+    {
+    uint32_t q16;
+    if (!batch_parse_q16 (p, end, &q16)) return FALSE;
+    return batch_apply (self, pin, BATCH_KIND_DUTY_Q16, q16);
+    }
+  if (op == ':')
+    {
+    uint32_t usec = 0;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9' && usec < 100000000)
+      usec = usec * 10 + (*p++ - '0');
+    if (p != end || p == digits) return FALSE;
+    return batch_apply (self, pin, BATCH_KIND_PULSE_USEC, usec);
+    }
+  return FALSE;
+  }
+
+/*============================================================================
+  batch_is_separator
+============================================================================*/
+static inline BOOL batch_is_separator (char c)
+  {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == ',' 
+    || c == ';';
+  }
+
+/*============================================================================
+  batch_feed_text
+============================================================================*/
+static int batch_feed_text (Batch *self, const char *data, size_t len)
+  {
+  int applied = 0;
+  const char *p = data, *end = data + len;
+
+  // Finish off the token left over from the last read
+  if (self->partial_len > 0 || self->overlong)
+    {
+    while (p < end && !batch_is_separator (*p))
+      {
+      if (self->partial_len < sizeof (self->partial))
+        self->partial[self->partial_len++] = *p;
+      else
+        self->overlong = TRUE;
+      p++;
+      }
+    if (p == end) return 0; // Still not complete
+    if (self->overlong) 
+      self->errors++;
+    else if (batch_parse_token (self, self->partial, 
+        self->partial + self->partial_len))
+      applied++;
+    else
+      self->errors++;
+    self->partial_len = 0;
+    self->overlong = FALSE;
+    }
+
+  while (p < end)
+    {
+    while (p < end && batch_is_separator (*p)) p++;
+    const char *token = p;
+    while (p < end && !batch_is_separator (*p)) p++;
+    if (token == p) break;
+    if (p == end)
+      {
+      // Incomplete -- hold it over
+      size_t n = p - token;
+      if (n > sizeof (self->partial))
+        {
+        n = sizeof (self->partial);
+        self->overlong = TRUE;
+        }
+      memcpy (self->partial, token, n);
+      self->partial_len = n;
+      break;
+      }
+    if (batch_parse_token (self, token, p))
+      applied++;
+    else
+      self->errors++;
+    }
+  return applied;
+  }
+
+/*============================================================================
+  batch_feed_binary
+============================================================================*/
+static int batch_feed_binary (Batch *self, const char *data, size_t len)
+  {
+  int applied = 0;
+  BatchRecord r;
+  if (self->partial_len > 0)
+    {
+    size_t n = sizeof (r) - self->partial_len;
+    if (n > len) n = len;
+    memcpy (self->partial + self->partial_len, data, n);
+    self->partial_len += n;
+    data += n;
+    len -= n;
+    if (self->partial_len < sizeof (r)) return 0;
+    memcpy (&r, self->partial, sizeof (r));
+    self->partial_len = 0;
+    if (batch_apply (self, r.pin, r.kind, r.value)) 
+      applied++;
+    else
+      self->errors++;
+    }
+  for (; len >= sizeof (r); data += sizeof (r), len -= sizeof (r))
+    {
+    memcpy (&r, data, sizeof (r)); // data need not be aligned
+    if (batch_apply (self, r.pin, r.kind, r.value)) 
+      applied++;
+    else
+      self->errors++;
+    }
+  memcpy (self->partial, data, len);
+  self->partial_len = len;
+  return applied;
+  }
+
+/*============================================================================
+  batch_feed
+============================================================================*/
+int batch_feed (Batch *self, const char *data, size_t len)
+  {
+  assert (self != NULL);
+  if (self->binary)
+    return batch_feed_binary (self, data, len);
+  return batch_feed_text (self, data, len);
+  }
+
+/*============================================================================
+  batch_run_fd
+============================================================================*/
+int batch_run_fd (Batch *self, int fd)
+  {
+  assert (self != NULL);
+  for (;;)
+    {
+    ssize_t n = read (fd, self->buf, sizeof (self->buf));
+    if (n > 0)
+      batch_feed (self, self->buf, n);
+    else if (n == 0)
+      {
+      // A text command needn't be followed by a separator at the very 
+      //  end, but a binary record must be complete
+      if (!self->binary)
+        batch_feed (self, "\n", 1);
+      else if (self->partial_len > 0)
+        self->errors++;
+      self->partial_len = 0;
+      return 0;
+      }
+    else if (errno != EINTR)
+      return -1;
+    }
+  }
+
@@ -0,0 +1,60 @@
+/*============================================================================
+  
+  batch.h
+
+  A compact, non-interactive command stream for driving many PWM 
+  channels at once, read from a pipe or a socket. Commands can be text
+  or fixed-size binary records; see batch.c for the syntax.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct _Batch;
+typedef struct _Batch Batch;
+
+// Highest GPIO number that a command can address
+#define BATCH_MAX_PIN 63
+
+// What a binary record's value means
+#define BATCH_KIND_PULSE_USEC 0 // On-time, in usec
+#define BATCH_KIND_DUTY_Q16 1 // Duty, 0 to PWM_DUTY_Q16_ONE
+
+// One binary command, in host byte order
+typedef struct _BatchRecord
+  {
+  uint16_t pin;
+  uint16_t kind; // BATCH_KIND_...
+  uint32_t value;
+  } BatchRecord;
+
+BEGIN_DECLS
+
+/** Create a command stream parser. pwms is indexed by GPIO number, and 
+    has BATCH_MAX_PIN + 1 entries; commands for pins with no PWM are 
+    counted as errors. The array is copied, but the PWMs still belong 
+    to the caller. */
+Batch   *batch_create (PWM *const *pwms, BOOL binary);
+
+void     batch_destroy (Batch *self);
+
+/** Apply every complete command in the data, keeping any incomplete one
+    at the end until the rest of it arrives in the next call. Returns the
+    number of channel updates applied. */
+int      batch_feed (Batch *self, const char *data, size_t len);
+
+/** Read commands from fd until end of file, applying each read's worth
+    in one go. Returns 0 at end of file, or -1 with errno set. */
+int      batch_run_fd (Batch *self, int fd);
+
+/** The number of commands that could not be parsed, or were for a pin 
+    that has no PWM. */
+unsigned long batch_get_errors (const Batch *self);
+
+END_DECLS
+
@@ -0,0 +1,247 @@
+/*==========================================================================
+
+    config.c
+
+    The daemon's configuration file. Each line that is not blank, or a
+    comment starting with '#', lists one channel: its GPIO pin, then any
+    of these settings, in any order:
+
+    hz=N          PWM frequency (default 50)
+    backend=NAME  sysfs, gpiomem, dma, hwpwm, chardev, sim or auto
+                  (the default)
+    servo=MIN-MAX the channel drives a servo that accepts pulses of MIN
+                  to MAX usec; it is moved to the middle of the range at
+                  start-up, unless start is given
+    phase=USEC    start of the pulse within the cycle (default 0)
+    priority=N    SCHED_FIFO priority, 1-99, for the timing thread
+    start=USEC    on-time at start-up (default 0, fully off)
+    dither=0|1    dither the on-time, for finer duties (default 0)
+    idle=MSEC     stop pulsing, leaving the pin low, once the channel
+                  has gone MSEC msec without being set (default 0, 
+                  never)
+
+    For example:
+
+    # Pan and tilt servos, and a status LED
+    17 servo=500-2500 priority=50 idle=2000
+    18 servo=1000-2000 phase=2500 priority=50
+    27 hz=500 backend=gpiomem start=100 dither=1
+
+    All the channels, whatever their frequencies, share one timing 
+    thread, which runs at the highest priority that any of them asks 
+    for. DMA channels have no timing thread, and their priority is 
+    ignored.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include "defs.h"
+#include "pwm.h"
+#include "pwm_internal.h"
+#include "config.h"
+
+// Backend names, in PWMBackend order
+static const char *const config_backends[] =
+  { "sysfs", "gpiomem", "dma", "hwpwm", "chardev", "sim", "auto" };
+
+/*============================================================================
+  config_create
+============================================================================*/
+Config *config_create (void)
+  {
+  Config *self = malloc (sizeof (Config));
+  memset (self, 0, sizeof (Config));
+  return self;
+  }
+
+/*============================================================================
+  config_destroy
+============================================================================*/
+void config_destroy (Config *self)
+  {
+  free (self);
+  }
+
+/*============================================================================
+  config_add_channel
+============================================================================*/
+ConfigChannel *config_add_channel (Config *self, int pin)
+  {
+  assert (self != NULL);
+  if (pin < 0 || pin > CONFIG_MAX_PIN) return NULL;
+  for (int i = 0; i < self->num_channels; i++)
+    if (self->channels[i].pin == pin) return NULL;
+  ConfigChannel *channel = &self->channels[self->num_channels++];
+  memset (channel, 0, sizeof (ConfigChannel));
+  channel->pin = pin;
+  channel->cycle_usec = 1000000 / CONFIG_DEFAULT_HZ;
+  channel->backend = CONFIG_DEFAULT_BACKEND;
+  channel->start_usec = -1;
+  return channel;
+  }
+
+/*============================================================================
+  config_parse_int
+
+  Parse the whole of s as a decimal integer in min..max.
+
+============================================================================*/
+static BOOL config_parse_int (const char *s, int min, int max, int *value)
+  {
+  char *end;
+  errno = 0;
+  long n = strtol (s, &end, 10);
+  if (end == s || *end != 0 || errno != 0 || n < min || n > max)
+    return FALSE;
+  *value = (int)n;
+  return TRUE;
+  }
+
+/*============================================================================
+  config_parse_setting
+
+  Apply one "key=value" setting to the channel. Returns an error message,
+  or NULL if the setting is valid.
+
+============================================================================*/
+static const char *config_parse_setting (ConfigChannel *channel, char *s)
+  {
+  char *value = strchr (s, '=');
+  if (!value) return "expected key=value";
+  *value++ = 0;
+
+  if (strcmp (s, "hz") == 0)
+    {
+    int hz;
+    if (!config_parse_int (value, 1, 100000, &hz))
+      return "hz must be 1-100000";
+    channel->cycle_usec = 1000000 / hz;
+    }
+  else if (strcmp (s, "backend") == 0)
+    {
+    int n = sizeof (config_backends) / sizeof (config_backends[0]);
+    int i;
+    for (i = 0; i < n; i++)
+      if (strcmp (value, config_backends[i]) == 0) break;
+    if (i == n) return "unknown backend";
+    channel->backend = (PWMBackend)i;
+    }
+  else if (strcmp (s, "servo") == 0)
+    {
+    char *max = strchr (value, '-');
+    if (!max) return "servo must be MIN-MAX";
+    *max++ = 0;
+    if (!config_parse_int (value, 1, 1000000, &channel->servo_min_usec)
+        || !config_parse_int (max, channel->servo_min_usec, 1000000,
+             &channel->servo_max_usec))
+      return "servo must be MIN-MAX, with 0 < MIN <= MAX";
+    }
+  else if (strcmp (s, "phase") == 0)
+    {
+    if (!config_parse_int (value, 0, 1000000, &channel->phase_usec))
+      return "phase must be 0-1000000";
+    }
+  else if (strcmp (s, "priority") == 0)
+    {
+    if (!config_parse_int (value, 0, 99, &channel->rt_priority))
+      return "priority must be 0-99";
+    }
+  else if (strcmp (s, "dither") == 0)
+    {
+    if (!config_parse_int (value, 0, 1, &channel->dither))
+      return "dither must be 0 or 1";
+    }
+  else if (strcmp (s, "idle") == 0)
+    {
+    if (!config_parse_int (value, 0, 3600000, &channel->idle_msec))
+      return "idle must be 0-3600000";
+    }
+  else if (strcmp (s, "start") == 0)
+    {
+    if (!config_parse_int (value, 0, 1000000, &channel->start_usec))
+      return "start must be 0-1000000";
+    }
+  else
+    return "unknown setting";
+  return NULL;
+  }
+
+/*============================================================================
+  config_parse_line
+
+  Returns an error message, or NULL if the line is valid.
+
+============================================================================*/
+static const char *config_parse_line (Config *self, char *line)
+  {
+  char *hash = strchr (line, '#');
+  if (hash) *hash = 0;
+
+  char *save;
+  char *tok = strtok_r (line, " \t\r\n", &save);
+  if (!tok) return NULL; // Blank
+
+  int pin;
+  if (!config_parse_int (tok, 0, CONFIG_MAX_PIN, &pin))
+    return "expected a GPIO pin number";
+  ConfigChannel *channel = config_add_channel (self, pin);
+  if (!channel) return "pin is listed twice";
+
+  while ((tok = strtok_r (NULL, " \t\r\n", &save)))
+    {
+    const char *message = config_parse_setting (channel, tok);
+    if (message)
+      {
+      self->num_channels--;
+      return message;
+      }
+    }
+  if (channel->phase_usec >= channel->cycle_usec)
+    {
+    self->num_channels--;
+    return "phase must be shorter than the cycle";
+    }
+  return NULL;
+  }
+
+/*============================================================================
+  config_load
+============================================================================*/
+BOOL config_load (Config *self, const char *filename, char **error)
+  {
+  assert (self != NULL);
+  assert (filename != NULL);
+  FILE *f = fopen (filename, "r");
+  if (!f)
+    {
+    pwm_set_error (error, NULL, "Can't open %s: %s", filename, 
+      strerror (errno));
+    return FALSE;
+    }
+
+  BOOL ret = TRUE;
+  char *line = NULL;
+  size_t size = 0;
+  int line_num = 0;
+  while (ret && getline (&line, &size, f) >= 0)
+    {
+    line_num++;
+    const char *message = config_parse_line (self, line);
+    if (message)
+      {
+      pwm_set_error (error, NULL, "%s, line %d: %s", filename, line_num, 
+        message);
+      ret = FALSE;
+      }
+    }
+  free (line);
+  fclose (f);
+  return ret;
+  }
+
@@ -0,0 +1,69 @@
+/*============================================================================
+
+  config.h
+
+  The channel list for running pi-servo as a daemon, read from a
+  configuration file; see config.c for the syntax.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+// Highest GPIO number that a channel can use
+#define CONFIG_MAX_PIN 63
+
+// The most channels a configuration can list -- one per pin
+#define CONFIG_MAX_CHANNELS (CONFIG_MAX_PIN + 1)
+
+// Channel defaults, for settings that the file leaves out
+#define CONFIG_DEFAULT_HZ 50
+#define CONFIG_DEFAULT_BACKEND PWM_BACKEND_AUTO
+
+// One PWM channel
+typedef struct _ConfigChannel
+  {
+  int pin; // GPIO pin number
+  int cycle_usec; // Cycle length, from the frequency
+  PWMBackend backend;
+  // Pulse range of a servo on this channel, or both zero if it does not
+  //  drive a servo
+  int servo_min_usec;
+  int servo_max_usec;
+  int phase_usec; // Start of the pulse within the cycle
+  int rt_priority; // SCHED_FIFO priority 1-99, or 0 for normal scheduling
+  // On-time to start at, or -1 for the default, which is off -- or, for
+  //  a servo, the middle of its range
+  int start_usec;
+  BOOL dither; // Dither the on-time (see pwm_set_dither())
+  int idle_msec; // Stop pulsing after this long unset, or zero for never
+  } ConfigChannel;
+
+typedef struct _Config
+  {
+  int num_channels;
+  ConfigChannel channels[CONFIG_MAX_CHANNELS];
+  } Config;
+
+BEGIN_DECLS
+
+/** Create an empty configuration. Call config_destroy() when
+    finished. */
+Config  *config_create (void);
+
+void     config_destroy (Config *self);
+
+/** Add a channel on the given pin, with the defaults, and return it, so
+    that the caller can change its settings. Returns NULL if the pin is
+    out of range or already has a channel. */
+ConfigChannel *config_add_channel (Config *self, int pin);
+
+/** Add the channels listed in a configuration file. Returns FALSE, and
+    fills in *error, if the file can't be read, or has a line that
+    can't be parsed; the channels before that line are kept. Caller must
+    free *error if it is set. */
+BOOL     config_load (Config *self, const char *filename, char **error);
+
+END_DECLS
+
@@ -9,7 +9,7 @@
 #pragma once
 
 #ifdef __cplusplus
-#define BEGIN_DECLS exetern "C" { 
+#define BEGIN_DECLS extern "C" {
 #define END_DECLS }
 #else
 #define BEGIN_DECLS 
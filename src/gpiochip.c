@@ -0,0 +1,189 @@
+/*==========================================================================
+  
+    gpiochip.c
+
+    A thin layer over the GPIO v2 character-device uAPI. Unlike sysfs,
+    this needs no export/direction files, holds one fd for any number of
+    lines, and can change many lines at once. The line numbers in a 
+    request are indices into the request, not GPIO numbers, so we keep a
+    table mapping each GPIO number to its line bit.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "defs.h" 
+#include "gpiochip.h" 
+
+struct _GpioLines
+  {
+  int fd; // Line request fd
+  uint64_t pins; // Bit n set if GPIO n is in the request
+  uint64_t line_bit[GPIOCHIP_MAX_LINES]; // Line bit for GPIO n
+  };
+
+/*============================================================================
+  gpiochip_request_lines
+
+  Make the line request, whose config the caller has filled in.
+
+============================================================================*/
+static GpioLines *gpiochip_request_lines (struct gpio_v2_line_request *req,
+    const int *pins, int num_pins)
+  {
+  strncpy (req->consumer, "pi-servo", sizeof (req->consumer) - 1);
+  req->num_lines = num_pins;
+
+  GpioLines *self = malloc (sizeof (GpioLines));
+  memset (self, 0, sizeof (GpioLines));
+  for (int i = 0; i < num_pins; i++)
+    {
+    if (pins[i] < 0 || pins[i] >= GPIOCHIP_MAX_LINES)
+      {
+      free (self);
+      errno = EINVAL;
+      return NULL;
+      }
+    req->offsets[i] = pins[i];
+    self->pins |= 1ULL << pins[i];
+    self->line_bit[pins[i]] = 1ULL << i;
+    }
+
+  int chip = open (GPIOCHIP_DEVICE, O_RDWR | O_CLOEXEC);
+  if (chip < 0)
+    {
+    free (self);
+    return NULL;
+    }
+  int ret = ioctl (chip, GPIO_V2_GET_LINE_IOCTL, req);
+  int saved_errno = errno;
+  close (chip); // The line request fd stays open without the chip fd
+  if (ret < 0)
+    {
+    free (self);
+    errno = saved_errno;
+    return NULL;
+    }
+  self->fd = req->fd;
+  return self;
+  }
+
+/*============================================================================
+  gpiochip_request
+============================================================================*/
+GpioLines *gpiochip_request (const int *pins, int num_pins)
+  {
+  if (num_pins <= 0 || num_pins > GPIOCHIP_MAX_LINES)
+    {
+    errno = EINVAL;
+    return NULL;
+    }
+  struct gpio_v2_line_request req;
+  memset (&req, 0, sizeof (req));
+  req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+  req.config.num_attrs = 1;
+  req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+  req.config.attrs[0].attr.values = 0; // All low
+  req.config.attrs[0].mask = num_pins == 64 ? ~0ULL : (1ULL << num_pins) - 1;
+  return gpiochip_request_lines (&req, pins, num_pins);
+  }
+
+/*============================================================================
+  gpiochip_request_edges
+
+  The kernel timestamps each edge in its interrupt handler, on 
+  CLOCK_MONOTONIC unless told otherwise, which is the clock the timing
+  threads use, so the times can be compared directly.
+
+============================================================================*/
+GpioLines *gpiochip_request_edges (const int *pins, int num_pins)
+  {
+  if (num_pins <= 0 || num_pins > GPIOCHIP_MAX_LINES)
+    {
+    errno = EINVAL;
+    return NULL;
+    }
+  struct gpio_v2_line_request req;
+  memset (&req, 0, sizeof (req));
+  req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING
+    | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+  req.event_buffer_size = GPIOCHIP_EVENT_BUFFER * num_pins;
+  return gpiochip_request_lines (&req, pins, num_pins);
+  }
+
+/*============================================================================
+  gpiochip_read_edges
+============================================================================*/
+int gpiochip_read_edges (GpioLines *self, GpioEdge *edges, int max, 
+    int timeout_msec)
+  {
+  struct pollfd pfd = { self->fd, POLLIN, 0 };
+  int ret = poll (&pfd, 1, timeout_msec);
+  if (ret <= 0) return ret;
+
+  struct gpio_v2_line_event events[64];
+  if (max > 64) max = 64;
+  ssize_t n = read (self->fd, events, max * sizeof (events[0]));
+  if (n < 0) return -1;
+  int count = (int)(n / sizeof (events[0]));
+  for (int i = 0; i < count; i++)
+    {
+    edges[i].time_ns = (int64_t)events[i].timestamp_ns;
+    edges[i].pin = (int)events[i].offset;
+    edges[i].level = events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+    edges[i].seqno = events[i].line_seqno;
+    }
+  return count;
+  }
+
+/*============================================================================
+  gpiochip_release
+============================================================================*/
+void gpiochip_release (GpioLines *self)
+  {
+  if (self)
+    {
+    close (self->fd);
+    free (self);
+    }
+  }
+
+/*============================================================================
+  gpiochip_write_masks
+============================================================================*/
+int gpiochip_write_masks (GpioLines *self, uint64_t set_mask, 
+    uint64_t clr_mask)
+  {
+  struct gpio_v2_line_values values = { 0, 0 };
+  uint64_t pins = (set_mask | clr_mask) & self->pins;
+  while (pins)
+    {
+    int pin = __builtin_ctzll (pins);
+    uint64_t bit = self->line_bit[pin];
+    values.mask |= bit;
+    if (set_mask & (1ULL << pin))
+      values.bits |= bit;
+    pins &= pins - 1;
+    }
+  if (values.mask == 0) return 0;
+  return ioctl (self->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0 ? -1 : 0;
+  }
+
+/*============================================================================
+  gpiochip_write
+============================================================================*/
+int gpiochip_write (GpioLines *self, int pin, int value)
+  {
+  uint64_t bit = 1ULL << pin;
+  return gpiochip_write_masks (self, value ? bit : 0, value ? 0 : bit);
+  }
+
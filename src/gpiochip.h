@@ -0,0 +1,78 @@
+/*============================================================================
+
+  gpiochip.h
+
+  GPIO output through the kernel's GPIO character device (/dev/gpiochipN),
+  using the v2 uAPI directly, rather than through libgpiod. Any number of
+  lines, up to 64, can be requested together, and then set together with
+  a single ioctl. Lines can also be requested as inputs, with their
+  edges timestamped by the kernel, to see what the outputs really did.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// The GPIO chip whose line offsets are the BCM GPIO numbers
+#ifndef GPIOCHIP_DEVICE
+#define GPIOCHIP_DEVICE "/dev/gpiochip0"
+#endif
+
+// The most lines a single request can hold (GPIO_V2_LINES_MAX)
+#define GPIOCHIP_MAX_LINES 64
+
+// Size of the kernel's event queue for each input line
+#define GPIOCHIP_EVENT_BUFFER 1024
+
+struct _GpioLines;
+typedef struct _GpioLines GpioLines;
+
+// One edge on an input line
+typedef struct _GpioEdge
+  {
+  int64_t time_ns; // When the kernel saw it, on CLOCK_MONOTONIC
+  int pin;
+  int level; // Level after the edge
+  // Count of the pin's edges, from 1. A gap means that the kernel's queue
+  //  overflowed, and edges were lost
+  unsigned seqno;
+  } GpioEdge;
+
+BEGIN_DECLS
+
+/** Request the pins as outputs, initially low, in one line request.
+    Returns NULL with errno set on failure. The pins must all be less
+    than 64. */
+GpioLines *gpiochip_request (const int *pins, int num_pins);
+
+/** Request the pins as inputs, with every rising and falling edge
+    timestamped by the kernel and queued for gpiochip_read_edges().
+    Returns NULL with errno set on failure. The pins must all be less
+    than 64. */
+GpioLines *gpiochip_request_edges (const int *pins, int num_pins);
+
+/** Read up to max queued edges from lines requested with
+    gpiochip_request_edges(), waiting up to timeout_msec for the first
+    (or forever, if it is negative). Returns the number read, 0 if none
+    came in time, or -1 with errno set. */
+int        gpiochip_read_edges (GpioLines *self, GpioEdge *edges, int max,
+             int timeout_msec);
+
+/** Release the lines. Their outputs are left as they are. */
+void       gpiochip_release (GpioLines *self);
+
+/** Drive the pins whose bits are set in set_mask high, and those in
+    clr_mask low, with one ioctl. Bit n of each mask is GPIO n; pins that
+    are not part of this request are ignored. Returns 0, or -1 with errno
+    set. */
+int        gpiochip_write_masks (GpioLines *self, uint64_t set_mask,
+             uint64_t clr_mask);
+
+/** Drive one pin high or low. */
+int        gpiochip_write (GpioLines *self, int pin, int value);
+
+END_DECLS
+
@@ -0,0 +1,80 @@
+/*==========================================================================
+
+    gpiomem.c
+
+    Memory-mapped GPIO register access for the BCM283x family. The
+    kernel's /dev/gpiomem device maps just the GPIO block, and does not
+    need root privileges -- membership of the 'gpio' group is enough.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "defs.h"
+#include "gpiomem.h"
+
+volatile uint32_t *gpiomem_regs = NULL;
+
+// Several PWM instances might be started from different threads, so
+//  guard the one-time mapping
+static pthread_mutex_t gpiomem_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*============================================================================
+  gpiomem_open
+============================================================================*/
+int gpiomem_open (void)
+  {
+  int ret = 0;
+  pthread_mutex_lock (&gpiomem_mutex);
+  if (gpiomem_regs == NULL)
+    {
+    int fd = open ("/dev/gpiomem", O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd >= 0)
+      {
+      void *map = mmap (NULL, GPIOMEM_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+      int saved_errno = errno;
+      close (fd); // The mapping stays valid after the fd is closed
+      if (map != MAP_FAILED)
+        gpiomem_regs = (volatile uint32_t *)map;
+      else
+        {
+        errno = saved_errno;
+        ret = -1;
+        }
+      }
+    else
+      ret = -1;
+    }
+  pthread_mutex_unlock (&gpiomem_mutex);
+  return ret;
+  }
+
+/*============================================================================
+  gpiomem_set_output
+============================================================================*/
+void gpiomem_set_output (int pin)
+  {
+  // Three bits per pin, ten pins per register; 001 means "output"
+  volatile uint32_t *fsel = gpiomem_regs + GPIOMEM_GPFSEL0 + pin / 10;
+  int shift = (pin % 10) * 3;
+  pthread_mutex_lock (&gpiomem_mutex);
+  *fsel = (*fsel & ~(7u << shift)) | (1u << shift);
+  pthread_mutex_unlock (&gpiomem_mutex);
+  }
+
+/*============================================================================
+  gpiomem_get_function
+============================================================================*/
+int gpiomem_get_function (int pin)
+  {
+  uint32_t fsel = gpiomem_regs[GPIOMEM_GPFSEL0 + pin / 10];
+  return (int)((fsel >> ((pin % 10) * 3)) & 7);
+  }
+
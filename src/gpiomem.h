@@ -0,0 +1,81 @@
+/*============================================================================
+
+  gpiomem.h
+
+  Direct access to the BCM283x GPIO registers, through the memory map
+  provided by /dev/gpiomem. Setting or clearing a pin this way is a
+  single memory store, with no kernel trap.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// Register offsets, in 32-bit words, from the start of the GPIO block.
+//  Each function-select register covers ten pins; each set/clear/level
+//  register covers 32 pins, and there are two banks of each.
+#define GPIOMEM_GPFSEL0 0
+#define GPIOMEM_GPSET0 7
+#define GPIOMEM_GPCLR0 10
+#define GPIOMEM_GPLEV0 13
+
+#define GPIOMEM_BLOCK_SIZE 4096
+
+// Function-select codes (see gpiomem_get_function())
+#define GPIOMEM_FUNC_INPUT 0
+#define GPIOMEM_FUNC_OUTPUT 1
+#define GPIOMEM_FUNC_ALT0 4
+#define GPIOMEM_FUNC_ALT5 2
+
+// Highest GPIO number that the BCM283x GPIO block knows about
+#define GPIOMEM_MAX_PIN 53
+
+BEGIN_DECLS
+
+// Base of the mapped register block, or NULL if gpiomem_open() has not
+//  succeeded yet.
+extern volatile uint32_t *gpiomem_regs;
+
+/** Map the GPIO registers, if they are not mapped already. The mapping
+    is kept for the lifetime of the process, so it is safe for a PWM
+    thread to keep writing after its pin has been released. Returns 0 on
+    success, or -1 with errno set. */
+int      gpiomem_open (void);
+
+/** Set the function of the pin to "output". gpiomem_open() must have
+    succeeded. */
+void     gpiomem_set_output (int pin);
+
+/** The pin's current function, as a GPIOMEM_FUNC_ code: which, if any,
+    of the SoC's peripherals it is routed to. gpiomem_open() must have
+    succeeded. */
+int      gpiomem_get_function (int pin);
+
+/** Drive the pin high or low with a single store to GPSETn or GPCLRn. */
+static inline void gpiomem_write (int pin, int value)
+  {
+  volatile uint32_t *reg = gpiomem_regs
+    + (value ? GPIOMEM_GPSET0 : GPIOMEM_GPCLR0) + (pin >> 5);
+  *reg = 1u << (pin & 31);
+  }
+
+/** Drive every pin whose bit is set in set_mask high, and every pin 
+    whose bit is set in clr_mask low, with one store per register bank 
+    that has anything to change. Bit n of each mask is GPIO n. */
+static inline void gpiomem_write_masks (uint64_t set_mask, uint64_t clr_mask)
+  {
+  if ((uint32_t)set_mask) 
+    gpiomem_regs[GPIOMEM_GPSET0] = (uint32_t)set_mask;
+  if (set_mask >> 32) 
+    gpiomem_regs[GPIOMEM_GPSET0 + 1] = (uint32_t)(set_mask >> 32);
+  if ((uint32_t)clr_mask) 
+    gpiomem_regs[GPIOMEM_GPCLR0] = (uint32_t)clr_mask;
+  if (clr_mask >> 32) 
+    gpiomem_regs[GPIOMEM_GPCLR0 + 1] = (uint32_t)(clr_mask >> 32);
+  }
+
+END_DECLS
+
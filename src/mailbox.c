@@ -0,0 +1,107 @@
+/*==========================================================================
+  
+    mailbox.c
+
+    Minimal client for the VideoCore firmware's property mailbox. Each
+    request is a buffer of 32-bit words: total size, request code, then
+    tags of the form (tag id, value buffer size, request size, values...),
+    ending with a zero tag. The firmware overwrites the values with its
+    response.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "defs.h" 
+#include "mailbox.h" 
+
+#define MAILBOX_IOCTL_PROPERTY _IOWR (100, 0, char *)
+
+#define MAILBOX_TAG_MEM_ALLOC 0x3000c
+#define MAILBOX_TAG_MEM_LOCK 0x3000d
+#define MAILBOX_TAG_MEM_UNLOCK 0x3000e
+#define MAILBOX_TAG_MEM_FREE 0x3000f
+
+/*============================================================================
+  mailbox_property
+
+  Send a request with a single tag, taking up to three values, and 
+  return the first value of the response, or zero if the call failed.
+
+============================================================================*/
+static uint32_t mailbox_property (int fd, uint32_t tag, int num_values, 
+    uint32_t v0, uint32_t v1, uint32_t v2)
+  {
+  uint32_t p[32];
+  int i = 0;
+  p[i++] = 0; // Total size, filled in below
+  p[i++] = 0; // Process request
+  p[i++] = tag;
+  p[i++] = 4 * num_values; // Size of the value buffer
+  p[i++] = 4 * num_values; // Size of the request data
+  p[i++] = v0;
+  if (num_values > 1) p[i++] = v1;
+  if (num_values > 2) p[i++] = v2;
+  p[i++] = 0; // End tag
+  p[0] = i * sizeof (uint32_t);
+  if (ioctl (fd, MAILBOX_IOCTL_PROPERTY, p) < 0)
+    return 0;
+  return p[5];
+  }
+
+/*============================================================================
+  mailbox_open
+============================================================================*/
+int mailbox_open (void)
+  {
+  return open ("/dev/vcio", O_RDWR | O_CLOEXEC);
+  }
+
+/*============================================================================
+  mailbox_close
+============================================================================*/
+void mailbox_close (int fd)
+  {
+  if (fd >= 0)
+    close (fd);
+  }
+
+/*============================================================================
+  mailbox_mem_alloc
+============================================================================*/
+uint32_t mailbox_mem_alloc (int fd, uint32_t size, uint32_t align, 
+    uint32_t flags)
+  {
+  return mailbox_property (fd, MAILBOX_TAG_MEM_ALLOC, 3, size, align, flags);
+  }
+
+/*============================================================================
+  mailbox_mem_lock
+============================================================================*/
+uint32_t mailbox_mem_lock (int fd, uint32_t handle)
+  {
+  return mailbox_property (fd, MAILBOX_TAG_MEM_LOCK, 1, handle, 0, 0);
+  }
+
+/*============================================================================
+  mailbox_mem_unlock
+============================================================================*/
+void mailbox_mem_unlock (int fd, uint32_t handle)
+  {
+  mailbox_property (fd, MAILBOX_TAG_MEM_UNLOCK, 1, handle, 0, 0);
+  }
+
+/*============================================================================
+  mailbox_mem_free
+============================================================================*/
+void mailbox_mem_free (int fd, uint32_t handle)
+  {
+  mailbox_property (fd, MAILBOX_TAG_MEM_FREE, 1, handle, 0, 0);
+  }
+
@@ -0,0 +1,48 @@
+/*============================================================================
+  
+  mailbox.h
+
+  The VideoCore mailbox property interface, through /dev/vcio. This is
+  only used to get blocks of physically-contiguous, uncached memory that
+  the DMA controller can read.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// Flags for mailbox_mem_alloc(). "Direct" memory is addressed through 
+//  the uncached 0xC0000000 bus alias, which is what DMA needs
+#define MAILBOX_MEM_FLAG_DIRECT (1 << 2)
+#define MAILBOX_MEM_FLAG_COHERENT (2 << 2)
+#define MAILBOX_MEM_FLAG_L1_NONALLOCATING (MAILBOX_MEM_FLAG_DIRECT \
+          | MAILBOX_MEM_FLAG_COHERENT)
+
+BEGIN_DECLS
+
+/** Open the mailbox device. Returns a file descriptor, or -1 with errno
+    set. */
+int      mailbox_open (void);
+
+/** Close the mailbox device. */
+void     mailbox_close (int fd);
+
+/** Allocate GPU memory. Returns a handle, or zero on failure. */
+uint32_t mailbox_mem_alloc (int fd, uint32_t size, uint32_t align, 
+           uint32_t flags);
+
+/** Lock memory in place, and return its bus address, or zero on 
+    failure. */
+uint32_t mailbox_mem_lock (int fd, uint32_t handle);
+
+/** Undo mailbox_mem_lock(). */
+void     mailbox_mem_unlock (int fd, uint32_t handle);
+
+/** Release memory from mailbox_mem_alloc(). */
+void     mailbox_mem_free (int fd, uint32_t handle);
+
+END_DECLS
+
@@ -16,6 +16,34 @@
     Of course, if you're just setting the brightness of an LED, then the full
     output range can be used.
 
+    Usage: pi-servo [-p pins] [-c cycle_usec] [-f config] [-b] [-B] 
+                    [-S socket] [-M shm_name]
+
+    With no options, drive GPIO 17 at 50 Hz, interactively: prompt for a 
+    fraction, and set it as the duty. The options are:
+
+    -p  comma-separated list of GPIO pins (default 17); the interactive
+        mode uses only the first
+    -c  PWM cycle length in usec (default 20000)
+    -f  run as a daemon, driving the channels listed in this file (see 
+        config.c), each with its own frequency, backend, servo range,
+        phase and priority, in place of -p and -c. Unless -b, -B or -S 
+        is given as well, run until SIGINT or SIGTERM
+    -b  batch mode: read a stream of commands from stdin, like "17=0.075"
+        (duty) or "18:1500" (on-time in usec), separated by whitespace,
+        commas or semicolons, until end of file (see batch.c)
+    -B  as -b, but the commands are binary BatchRecords (see batch.h)
+    -S  as -b or -B, but accept commands on a Unix-domain stream socket
+        at this path, one client at a time, rather than on stdin
+    -M  create a shared-memory segment with this name (e.g. /pi-servo), 
+        with one channel per pin, in the order of -p or of the config 
+        file, which other processes can set on-times in without making 
+        system calls (see pwm_shm.h). None of the channels can use DMA. 
+        Unless -b, -B or -S is given as well, run until SIGINT or SIGTERM
+
+    In every mode, SIGINT and SIGTERM stop all the channels, leaving the
+    pins low, before the program exits.
+
     CPU usage, of course, depends on the number of PWM cycles per second.
     There are typical figures for the Pi 3B+
     50 Hz   Too small to measure
@@ -25,62 +53,457 @@
     Copyright (c)2020 Kevin Boone, GPL v3.0
 
 ============================================================================*/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <getopt.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "defs.h" 
 #include "pwm.h" 
+#include "pwm_engine.h" 
+#include "batch.h" 
+#include "pwm_shm.h" 
+#include "servo.h" 
+#include "config.h" 
 
-// This is the GPIO pin to connect the servo (or whatever) to
+// This is the default GPIO pin to connect the servo (or whatever) to
 #define PIN 17
 
+// Default PWM cycle length, in usec -- 50 Hz
+#define CYCLE_USEC 20000
+
+// How commands reach the channels once they're running
+typedef enum
+  {
+  CONTROL_NONE = 0, // Only through shared memory, if at all
+  CONTROL_INTERACTIVE,
+  CONTROL_BATCH, // Batch commands on stdin
+  CONTROL_SOCKET // Batch commands on a Unix-domain socket
+  } ControlMode;
+
+// Everything that main() starts, so that it can all be stopped together
+typedef struct _Channels
+  {
+  int num_channels;
+  PWM *pwms[CONFIG_MAX_CHANNELS]; // In configuration order
+  Servo *servos[CONFIG_MAX_CHANNELS]; // For servo channels, else NULL
+  // Drives every channel but those using DMA, which have no timing 
+  //  thread
+  PWMEngine *engine;
+  int num_engine_channels;
+  int rt_priority; // Highest that any engine channel asks for
+  PWMShm *shm;
+  } Channels;
+
+// The thread that takes commands, while the main thread waits for a
+//  signal
+typedef struct _Control
+  {
+  ControlMode mode;
+  PWM *pwm; // For CONTROL_INTERACTIVE
+  Batch *batch; // For CONTROL_BATCH and CONTROL_SOCKET
+  const char *socket_path;
+  pthread_t main_thread; // Signalled when the commands run out
+  int ret; // Exit status
+  } Control;
+
+/*============================================================================
+  run_interactive
+
+  Loop, taking a fraction from the user. Set that fraction as the pwm 
+  duty cycle.
+
+============================================================================*/
+static void run_interactive (PWM *pwm)
+  {
+  pwm_set_duty (pwm, 0.0); // Off
+
+  double val = 1.0;
+  while (val > 0.0)
+    {
+    printf ("Set on fraction (0.0-1.0) or a negative number to stop: ");
+    fflush (stdout);
+    if (fscanf (stdin, "%lf", &val) != 1) break;
+    if (val > 0.0)
+      {
+      pwm_set_duty (pwm, val);
+      printf ("Setting %lf\n", val);
+      }
+    }
+  }
+
+/*============================================================================
+  run_socket
+
+  Listen on a Unix-domain socket, and read commands from each client in
+  turn until it disconnects. Only returns if the socket can't be set up.
+
+============================================================================*/
+static int run_socket (Batch *batch, const char *path)
+  {
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+    fprintf (stderr, "Socket path too long: %s\n", path);
+    return -1;
+    }
+  strcpy (addr.sun_path, path);
+  int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+    fprintf (stderr, "Can't create socket: %s\n", strerror (errno));
+    return -1;
+    }
+  unlink (path);
+  if (bind (fd, (struct sockaddr *)&addr, sizeof (addr)) != 0 
+      || listen (fd, 1) != 0)
+    {
+    fprintf (stderr, "Can't listen on %s: %s\n", path, strerror (errno));
+    close (fd);
+    return -1;
+    }
+  for (;;)
+    {
+    int client = accept4 (fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0)
+      {
+      if (errno == EINTR) continue;
+      fprintf (stderr, "Can't accept on %s: %s\n", path, strerror (errno));
+      break;
+      }
+    if (batch_run_fd (batch, client) != 0)
+      fprintf (stderr, "Error reading from client: %s\n", strerror (errno));
+    close (client);
+    }
+  close (fd);
+  unlink (path);
+  return -1;
+  }
+
+/*============================================================================
+  parse_pins
+============================================================================*/
+static int parse_pins (char *list, int *pins, int max)
+  {
+  int n = 0;
+  for (char *tok = strtok (list, ","); tok; tok = strtok (NULL, ","))
+    {
+    int pin = atoi (tok);
+    if (n >= max || pin < 0 || pin > CONFIG_MAX_PIN) return -1;
+    pins[n++] = pin;
+    }
+  return n;
+  }
+
+/*============================================================================
+  create_channels
+
+  Create the PWMs, and add them to the engine, but don't start 
+  anything.
+
+============================================================================*/
+static void create_channels (Channels *self, const Config *config)
+  {
+  memset (self, 0, sizeof (Channels));
+  self->engine = pwm_engine_create (CYCLE_USEC);
+  for (int i = 0; i < config->num_channels; i++)
+    {
+    const ConfigChannel *c = &config->channels[i];
+    PWM *pwm = pwm_create_backend (c->pin, c->backend);
+    self->pwms[self->num_channels++] = pwm;
+    pwm_set_dither (pwm, c->dither);
+    pwm_set_idle_timeout (pwm, c->idle_msec);
+    if (c->backend == PWM_BACKEND_DMA) continue;
+    pwm_set_phase (pwm, c->phase_usec);
+    pwm_engine_add_with_cycle (self->engine, pwm, c->cycle_usec);
+    self->num_engine_channels++;
+    if (c->rt_priority > self->rt_priority)
+      self->rt_priority = c->rt_priority;
+    }
+  }
+
+/*============================================================================
+  stop_channels
+
+  Stop everything that is running, leaving every pin low. This is safe 
+  to call more than once.
+
+============================================================================*/
+static void stop_channels (Channels *self)
+  {
+  pwm_engine_stop (self->engine);
+  for (int i = 0; i < self->num_channels; i++)
+    pwm_stop (self->pwms[i]); // Does nothing for engine channels
+  }
+
+/*============================================================================
+  start_channels
+
+  Start the engine, and the DMA channels. If any can't be started,
+  none are left running.
+
+============================================================================*/
+static BOOL start_channels (Channels *self, const Config *config, 
+    const char *shm_name, char **error)
+  {
+  if (shm_name)
+    {
+    if (self->num_engine_channels != self->num_channels)
+      {
+      *error = strdup ("Shared memory can't be used with DMA channels");
+      return FALSE;
+      }
+    self->shm = pwm_shm_create (shm_name, self->engine, self->pwms, 
+      self->num_channels, error);
+    if (!self->shm) return FALSE;
+    }
+
+  BOOL ok = TRUE;
+  if (self->num_engine_channels > 0)
+    {
+    PWMOptions options;
+    pwm_options_init (&options);
+    options.rt_priority = self->rt_priority;
+    ok = pwm_engine_start_with_options (self->engine, &options, error);
+    }
+  for (int i = 0; ok && i < self->num_channels; i++)
+    {
+    const ConfigChannel *c = &config->channels[i];
+    if (c->backend != PWM_BACKEND_DMA) continue;
+    PWMOptions options;
+    pwm_options_init (&options);
+    options.rt_priority = c->rt_priority;
+    ok = pwm_start_with_options (self->pwms[i], c->cycle_usec, &options, 
+      error);
+    }
+  if (!ok)
+    {
+    stop_channels (self);
+    return FALSE;
+    }
+
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    const ConfigChannel *c = &config->channels[i];
+    if (c->servo_max_usec > 0)
+      {
+      Servo *servo = servo_create (self->pwms[i]);
+      servo_set_range (servo, c->servo_min_usec, c->servo_max_usec);
+      servo_move_to (servo, c->start_usec >= 0 ? c->start_usec 
+        : (c->servo_min_usec + c->servo_max_usec) / 2, 0);
+      self->servos[i] = servo;
+      }
+    else if (c->start_usec > 0)
+      pwm_set_pulse_usec (self->pwms[i], c->start_usec);
+    }
+  return TRUE;
+  }
+
+/*============================================================================
+  destroy_channels
+============================================================================*/
+static void destroy_channels (Channels *self)
+  {
+  stop_channels (self);
+  // The shared memory has the engine's cycle hook, so it must go before
+  //  the engine does
+  pwm_shm_destroy (self->shm);
+  pwm_engine_destroy (self->engine);
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    servo_destroy (self->servos[i]);
+    pwm_destroy (self->pwms[i]);
+    }
+  }
+
+/*============================================================================
+  run_control
+
+  The control thread: take commands until they run out, then wake the
+  main thread.
+
+============================================================================*/
+static void *run_control (void *arg)
+  {
+  Control *self = (Control *)arg;
+  switch (self->mode)
+    {
+    case CONTROL_INTERACTIVE:
+      run_interactive (self->pwm);
+      break;
+    case CONTROL_SOCKET:
+      self->ret = run_socket (self->batch, self->socket_path) == 0 ? 0 : 1;
+      break;
+    case CONTROL_BATCH:
+      if (batch_run_fd (self->batch, STDIN_FILENO) != 0)
+        {
+        fprintf (stderr, "Error reading commands: %s\n", strerror (errno));
+        self->ret = 1;
+        }
+      break;
+    case CONTROL_NONE:
+      break;
+    }
+  pthread_kill (self->main_thread, SIGTERM);
+  return NULL;
+  }
+
 /*============================================================================
   main
  
-  Note: in a real application, we'd trap signals and ensure that 
-  pwm_stop gets called before exit. Otherwise, if the program stops
-  unexpectedly, we could get stuck the output fully on.
+  Signals are blocked before any thread starts, so that no thread --
+  least of all a timing thread -- is killed by one. The main thread just
+  waits for SIGINT or SIGTERM, while another thread takes the commands,
+  then stops all the channels, so the pins are left low however the 
+  program is told to finish.
 
 ============================================================================*/
 int main (int argc, char **argv)
   {
-  argc = argc; argv = argv; // Suppress warnings
+  int pins[CONFIG_MAX_CHANNELS] = { PIN };
+  int num_pins = 1;
+  int cycle_usec = CYCLE_USEC;
+  BOOL batch_mode = FALSE, binary = FALSE;
+  const char *socket_path = NULL;
+  const char *shm_name = NULL;
+  const char *config_file = NULL;
 
-  PWM *pwm = pwm_create (PIN);
+  int opt;
+  while ((opt = getopt (argc, argv, "p:c:f:bBS:M:")) != -1)
+    {
+    switch (opt)
+      {
+      case 'p': 
+        num_pins = parse_pins (optarg, pins, CONFIG_MAX_CHANNELS); 
+        if (num_pins <= 0)
+          {
+          fprintf (stderr, "Pins must be 0-%d, at most %d of them\n", 
+            CONFIG_MAX_PIN, CONFIG_MAX_CHANNELS);
+          return 1;
+          }
+        break;
+      case 'c': cycle_usec = atoi (optarg); break;
+      case 'f': config_file = optarg; break;
+      case 'b': batch_mode = TRUE; break;
+      case 'B': batch_mode = TRUE; binary = TRUE; break;
+      case 'S': batch_mode = TRUE; socket_path = optarg; break;
+      case 'M': shm_name = optarg; break;
+      default:
+        fprintf (stderr, "Usage: %s [-p pins] [-c cycle_usec] [-f config] "
+          "[-b] [-B] [-S socket] [-M shm_name]\n", argv[0]);
+        return 1;
+      }
+    }
+  if (cycle_usec <= 0)
+    {
+    fprintf (stderr, "Cycle length must be positive\n");
+    return 1;
+    }
 
+  Config *config = config_create ();
   char *error = NULL;
-  if (pwm_start (pwm, 20000, &error)) // 50 Hz
-  //if (pwm_start (pwm, 2000, &error)) // 500 Hz
-  //if (pwm_start (pwm, 200, &error)) // 5000 Hz
+  if (config_file)
+    {
+    if (!config_load (config, config_file, &error)) 
+      {
+      fprintf (stderr, "%s\n", error);
+      free (error);
+      config_destroy (config);
+      return 1;
+      }
+    if (config->num_channels == 0)
+      {
+      fprintf (stderr, "%s lists no channels\n", config_file);
+      config_destroy (config);
+      return 1;
+      }
+    }
+  else
     {
-    pwm_set_duty (pwm, 0.0); // Off
+    for (int i = 0; i < num_pins; i++)
+      {
+      ConfigChannel *c = config_add_channel (config, pins[i]);
+      if (!c) continue; // Listed twice
+      c->cycle_usec = cycle_usec;
+      c->backend = PWM_BACKEND_SYSFS;
+      }
+    }
+
+  Control control;
+  memset (&control, 0, sizeof (Control));
+  control.main_thread = pthread_self ();
+  control.socket_path = socket_path;
+  if (batch_mode)
+    control.mode = socket_path ? CONTROL_SOCKET : CONTROL_BATCH;
+  else if (!shm_name && !config_file)
+    control.mode = CONTROL_INTERACTIVE;
 
-    // Loop, taking a fraction from the user. Set that fraction as the
-    //  pwm duty cycle.
-    double val = 1.0;
-    while (val > 0.0)
+  sigset_t signals;
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGINT);
+  sigaddset (&signals, SIGTERM);
+  pthread_sigmask (SIG_BLOCK, &signals, NULL);
+
+  Channels channels;
+  create_channels (&channels, config);
+  int ret = 1;
+  if (start_channels (&channels, config, shm_name, &error))
+    {
+    PWM *by_pin[BATCH_MAX_PIN + 1] = { NULL };
+    for (int i = 0; i < channels.num_channels; i++)
+      by_pin[config->channels[i].pin] = channels.pwms[i];
+    control.pwm = channels.pwms[0];
+    if (batch_mode) control.batch = batch_create (by_pin, binary);
+
+    pthread_t thread;
+    BOOL threaded = FALSE;
+    if (control.mode != CONTROL_NONE)
       {
-      printf ("Set on fraction (0.0-1.0) or a negative number to stop: ");
-      fflush (stdout);
-      fscanf (stdin, "%lf", &val);
-      if (val > 0.0)
+      int err = pthread_create (&thread, NULL, run_control, &control);
+      if (err == 0)
+        threaded = TRUE;
+      else
         {
-        pwm_set_duty (pwm, val);
-        printf ("Setting %lf\n", val);
+        fprintf (stderr, "Can't start control thread: %s\n", 
+          strerror (err));
+        control.ret = 1;
         }
       }
-
-    // Clean up. Important -- this stops the output, and leaves it int
-    //   the low state.
-    pwm_stop (pwm);
+    if (threaded || control.mode == CONTROL_NONE)
+      {
+      int sig;
+      sigwait (&signals, &sig);
+      }
+    if (threaded)
+      {
+      // Still reading commands if it was the signal that finished us
+      pthread_cancel (thread);
+      pthread_join (thread, NULL);
+      }
+    ret = control.ret;
+    if (control.batch)
+      {
+      if (batch_get_errors (control.batch) > 0)
+        fprintf (stderr, "%lu bad commands\n", 
+          batch_get_errors (control.batch));
+      batch_destroy (control.batch);
+      }
     }
   else
     {
     fprintf (stderr, "Can't start PWM: %s\n", error);
     free (error);
     }
+  // Leaves every pin low
+  destroy_channels (&channels);
+  config_destroy (config);
+  return ret;
   }
-
-
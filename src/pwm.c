@@ -4,7 +4,9 @@
 
     Simple software PWM for Raspberry Pi GPIO pins. Create an instance
     of this "class" for each pin to be controlled. Each instance
-    will create its own thread to do the timing. 
+    will create its own thread to do the timing, unless it is handed
+    to a PWMEngine (see pwm_engine.c), in which case one thread does
+    the timing for all the engine's pins.
 
     Typical calling sequence is:
 
@@ -22,6 +24,7 @@
 ============================================================================*/
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -29,37 +32,76 @@
 #include <assert.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include "defs.h" 
 #include "pwm.h" 
+#include "gpiomem.h" 
+#include "pwm_internal.h" 
+#include "pwm_time.h"
+#include "pwm_trace.h" 
+#include "pwm_thread.h" 
+#include "pwm_dma.h" 
+#include "pwm_hwpwm.h" 
+#include "gpiochip.h" 
+#include "pwm_sim.h" 
+#include "pwm_sysfs.h" 
 
-// PWM structure -- stores all internal data related to this
-//  PWM instance
-struct _PWM
+/*============================================================================
+  pwm_create
+============================================================================*/
+PWM *pwm_create (int pin)
   {
-  int pin; // GPIO pin number
-  pthread_t pthread; // Reference to the running thread
-  BOOL stop; // Set when pwm_stop() is called, to stop the PWM thead
-  int f_value; // Saved file handle for the 'value' pseudo-file
-  int cycle_usec; // PWM cycle-length, equals on_usec + off_usec
-  int on_usec; // "On" time in usec
-  int off_usec; // "Off" time in usec
-  };
+  return pwm_create_backend (pin, PWM_BACKEND_SYSFS);
+  }
 
-// Forward references
-static int pwm_write_to_file (const char *filename, const char *text);
-int pwm_setup_pin (PWM *self);
-int pwm_unsetup_pin (PWM *self);
-int pwm_set_pin (PWM *self, int value);
+// Instances handed out by pwm_pool_create(). The pool is only touched
+//  when a PWM is created or destroyed, so a mutex is cheap enough
+static PWM pwm_pool[PWM_POOL_SIZE];
+static BOOL pwm_pool_used[PWM_POOL_SIZE];
+static pthread_mutex_t pwm_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /*============================================================================
-  pwm_create
+  pwm_init
 ============================================================================*/
-PWM *pwm_create (int pin)
+static void pwm_init (PWM *self, int pin, PWMBackend backend)
   {
-  PWM *self = malloc (sizeof (PWM));
   memset (self, 0, sizeof (PWM));
   self->pin = pin;
+  self->backend = backend;
   self->f_value = -1;
+  }
+
+/*============================================================================
+  pwm_create_backend
+============================================================================*/
+PWM *pwm_create_backend (int pin, PWMBackend backend)
+  {
+  PWM *self = malloc (sizeof (PWM));
+  pwm_init (self, pin, backend);
+  return self;
+  }
+
+/*============================================================================
+  pwm_pool_create
+============================================================================*/
+PWM *pwm_pool_create (int pin, PWMBackend backend)
+  {
+  PWM *self = NULL;
+  pthread_mutex_lock (&pwm_pool_mutex);
+  for (int i = 0; i < PWM_POOL_SIZE && !self; i++)
+    {
+    if (!pwm_pool_used[i])
+      {
+      pwm_pool_used[i] = TRUE;
+      self = &pwm_pool[i];
+      }
+    }
+  pthread_mutex_unlock (&pwm_pool_mutex);
+  if (self)
+    {
+    pwm_init (self, pin, backend);
+    self->pooled = TRUE;
+    }
   return self;
   }
 
@@ -71,8 +113,72 @@ void pwm_destroy (PWM *self)
   if (self)
     {
     pwm_stop (self);
-    free (self);
+    if (self->pooled)
+      {
+      pthread_mutex_lock (&pwm_pool_mutex);
+      pwm_pool_used[self - pwm_pool] = FALSE;
+      pthread_mutex_unlock (&pwm_pool_mutex);
+      }
+    else
+      free (self);
+    }
+  }
+
+/*============================================================================
+  pwm_set_error
+============================================================================*/
+void pwm_set_error (char **error, const PWMOptions *options, 
+    const char *fmt, ...)
+  {
+  va_list ap;
+  va_start (ap, fmt);
+  if (options && options->error_buf && options->error_size > 0)
+    vsnprintf (options->error_buf, options->error_size, fmt, ap);
+  else if (error)
+    {
+    if (vasprintf (error, fmt, ap) < 0)
+      *error = NULL;
     }
+  va_end (ap);
+  }
+
+/*============================================================================
+  pwm_check_overrun
+
+  Record the timing of the edge just written, to level, which was due at
+  edge, and count an overrun if it was so late that the next one, due at next_edge,
+  should already have been written.
+============================================================================*/
+static void pwm_check_overrun (PWM *self, int level, int64_t edge, 
+    int64_t next_edge)
+  {
+  int64_t now = pwm_time_now ();
+  pwm_stats_edge (&self->stats, edge, now);
+  PWM_TRACE_EDGE (self->pin, level, edge, now);
+  if (now > next_edge)
+    atomic_fetch_add_explicit (&self->overruns, 1, memory_order_relaxed);
+  }
+
+/*============================================================================
+  pwm_park
+
+  The pin is at a level that will last until the PWM is set, so sleep 
+  until it is. The updates counter catches a setting that came in after
+  this cycle's timing was loaded, which would otherwise be slept 
+  through. On waking, cycle_start, the start of the next cycle, is moved
+  on to the first that hasn't started yet, so the pulses pick up at the
+  phase they had.
+
+============================================================================*/
+static void pwm_park (PWM *self, int64_t *cycle_start, int64_t cycle_ns)
+  {
+  atomic_store (&self->parked, TRUE);
+  if (atomic_load (&self->updates) == self->seen_updates)
+    pwm_time_park (&self->parked, PWM_TIME_FOREVER, 0, &self->stop);
+  atomic_store (&self->parked, FALSE);
+  int64_t now = pwm_time_now ();
+  pwm_time_resync (cycle_start, cycle_ns, now);
+  if (*cycle_start <= now) *cycle_start += cycle_ns;
   }
 
 /*============================================================================
@@ -84,40 +190,302 @@ void pwm_destroy (PWM *self)
   carried out by this method have the lowest possible overheads, as the
   loop time might be milliseconds, or even microseconds.
 
-  Since writing the value pseudo-file involves a kernel trap, there will
-  always be some overhead. For that reason, we handle the "fully on"
-  and "fully off" situations differently, and don't try to write a value
-  that we'll have to overwrite a millisecond later.
+  pwm_stop() wakes the thread from whatever wait it is in, and joins it,
+  before it touches the pin, so the loop never writes to a pin that has 
+  been released.
+
+  The waits are to absolute times on the monotonic clock: cycle n starts
+  at start + n * cycle_usec, and its falling edge is on_usec later. So the
+  time spent writing the pin, and the time the scheduler takes to wake
+  us, don't accumulate, and the period doesn't drift. If the thread is
+  held up so long that a whole cycle has gone by, that cycle is dropped
+  and the timeline resumes at the correct phase.
+
+  If PWM_TIMING_SPIN was selected, each wait ends with a busy-wait of 
+  guard_usec, so the edge isn't subject to the scheduler's wakeup latency.
+
+  With the sysfs backend, writing the value pseudo-file involves a kernel 
+  trap, so there will always be some overhead. For that reason, we handle
+  the "fully on" and "fully off" situations differently, and don't try to
+  write a value that we'll have to overwrite a millisecond later. Nor do
+  we write a level that the pin already has, and pulses (or gaps) 
+  shorter than min_pulse_usec are dropped altogether. Once the pin is at
+  a level that will last, the thread stops waking up every cycle, and 
+  parks until the PWM is set again (see pwm_park()).
 
 ============================================================================*/
 void *pwm_loop (void *arg)
   {
   PWM *self = (PWM *)arg;
+  int64_t cycle_ns = self->cycle_usec * PWM_NSEC_PER_USEC;
+  int64_t cycle_start = pwm_time_now ();
+  self->idle_since = cycle_start;
   while (!self->stop)
     {
-    if (self->on_usec != 0)
-      pwm_set_pin (self, 1); 
-    usleep (self->on_usec);
+    int on_usec, off_usec;
+    pwm_idle_step (self, cycle_start);
+    pwm_motion_step (self);
+    pwm_dither_step (self);
+    pwm_load_timing (self, &on_usec, &off_usec);
+    if (self->idle)
+      {
+      off_usec += on_usec;
+      on_usec = 0;
+      }
+    pwm_clamp_timing (&on_usec, &off_usec, self->min_pulse_usec);
+    int64_t fall = cycle_start + on_usec * PWM_NSEC_PER_USEC;
+    if (on_usec != 0)
+      {
+      if (pwm_write_level (self, 1))
+        pwm_check_overrun (self, 1, cycle_start, 
+          off_usec != 0 ? fall : cycle_start + cycle_ns);
+      }
     if (!self->stop)
       {
-      if (self->off_usec != 0)
-        pwm_set_pin (self, 0); 
-      usleep (self->off_usec);
+      if (off_usec != 0)
+        {
+        PWM_TRACE_WAIT (self->pin, fall);
+        pwm_time_sleep_until (fall, self->spin_ns, &self->stop);
+        PWM_TRACE_WAKE (self->pin, fall, pwm_time_now ());
+        if (pwm_write_level (self, 0))
+          pwm_check_overrun (self, 0, fall, cycle_start + cycle_ns);
+        }
       }
+    pwm_stats_bump (&self->stats.cycles);
+    cycle_start += cycle_ns;
+    if ((on_usec == 0 || off_usec == 0) && pwm_steady (self) && !self->stop)
+      pwm_park (self, &cycle_start, cycle_ns);
+    PWM_TRACE_WAIT (self->pin, cycle_start);
+    pwm_time_sleep_until (cycle_start, self->spin_ns, &self->stop);
+    PWM_TRACE_WAKE (self->pin, cycle_start, pwm_time_now ());
+    pwm_time_resync (&cycle_start, cycle_ns, pwm_time_now ());
     }
   return NULL;
   }
 
+/*============================================================================
+  pwm_move_pulse_usec
+============================================================================*/
+void pwm_move_pulse_usec (PWM *self, int target_usec, int frames)
+  {
+  assert (self != NULL);
+  if (!self->engine && (self->backend == PWM_BACKEND_DMA 
+       || self->backend == PWM_BACKEND_HWPWM))
+    {
+    pwm_set_pulse_usec (self, target_usec);
+    return;
+    }
+  if (target_usec < 0) target_usec = 0;
+  if (self->cycle_usec > 0 && target_usec > self->cycle_usec) 
+    target_usec = self->cycle_usec;
+  if (frames < 1) frames = 1;
+  // The top bit marks a move as pending, so that a move to zero in one
+  //  frame is not mistaken for no move at all
+  uint64_t move = ((uint64_t)1 << 63) 
+    | ((uint64_t)(frames & 0x7FFFFFFF) << 32) | (uint32_t)target_usec;
+  atomic_store_explicit (&self->move, move, memory_order_release);
+  atomic_fetch_add (&self->updates, 1);
+  if (self->engine)
+    pwm_engine_changed (self);
+  else
+    pwm_time_unpark (&self->parked);
+  }
+
+/*============================================================================
+  pwm_idle_step
+============================================================================*/
+BOOL pwm_idle_step (PWM *self, int64_t now)
+  {
+  unsigned updates = atomic_load_explicit (&self->updates, 
+    memory_order_acquire);
+  if (updates != self->seen_updates || pwm_ramping (self)) 
+    self->idle_since = now;
+  self->seen_updates = updates;
+  BOOL idle = self->idle_msec > 0 
+    && now - self->idle_since >= self->idle_msec * 1000000LL;
+  if (idle == self->idle) return FALSE;
+  self->idle = idle;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_motion_step
+
+  The ramp is stepped incrementally, from the on-time at the start of the 
+  move, with integer arithmetic only, so the last step lands exactly on
+  the target. If anything else has stored a new timing since our last
+  step, the application has set the duty directly, and that wins -- the
+  compare-and-swap catches one that lands while we're stepping.
+
+  While dithering, the on-time that the application sets is the fine 
+  one, so that is what the ramp steps, leaving pwm_dither_step() to 
+  store the timing.
+
+============================================================================*/
+BOOL pwm_motion_step (PWM *self)
+  {
+  PWMMotion *m = &self->motion;
+  uint64_t move = atomic_load_explicit (&self->move, memory_order_relaxed);
+  if (move == 0 && m->frame == m->frames) return FALSE;
+
+  BOOL dither = pwm_dithers (self);
+  atomic_uint_least64_t *word = dither ? &self->fine : &self->timing;
+  uint64_t expected = atomic_load_explicit (word, memory_order_acquire);
+  int on_usec = dither ? (int)(expected >> 16) 
+    : (int)(uint32_t)(expected >> 32);
+  if (move != 0)
+    {
+    move = atomic_exchange_explicit (&self->move, 0, memory_order_acquire);
+    m->from_usec = on_usec;
+    m->to_usec = (int)(uint32_t)move;
+    m->frames = (int)((move >> 32) & 0x7FFFFFFF);
+    m->frame = 0;
+    }
+  else if (dither ? expected != (uint64_t)m->last_usec << 16 
+      : on_usec != m->last_usec)
+    {
+    m->frame = m->frames;
+    return FALSE;
+    }
+
+  m->frame++;
+  int next = m->from_usec 
+    + (int)((int64_t)(m->to_usec - m->from_usec) * m->frame / m->frames);
+  uint64_t desired = dither ? (uint64_t)next << 16 
+    : pwm_pack_timing (next, self->cycle_usec - next);
+  if (!atomic_compare_exchange_strong_explicit (word, &expected, desired,
+       memory_order_acq_rel, memory_order_relaxed))
+    {
+    m->frame = m->frames;
+    return FALSE;
+    }
+  m->last_usec = next;
+  return next != on_usec;
+  }
+
+/*============================================================================
+  pwm_dither_step
+
+  First-order error accumulation: the fractions of a usec that each 
+  cycle drops are added up, and whenever they come to a whole usec, one
+  cycle gets it. So the on-time is only ever one of the two whole 
+  numbers either side of the fine one, and the mix of the two averages 
+  out to it.
+
+============================================================================*/
+BOOL pwm_dither_step (PWM *self)
+  {
+  if (!pwm_dithers (self)) return FALSE;
+  uint64_t fine = atomic_load_explicit (&self->fine, memory_order_acquire);
+  int next = (int)(fine >> 16);
+  self->dither_error += (uint32_t)fine & 0xFFFF;
+  if (self->dither_error >= 0x10000)
+    {
+    self->dither_error -= 0x10000;
+    next++;
+    }
+  int on_usec, off_usec;
+  pwm_load_timing (self, &on_usec, &off_usec);
+  if (next == on_usec) return FALSE;
+  pwm_store_timing (self, next, self->cycle_usec - next);
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_publish_pulse
+
+  Store a new on-time, and tell whatever drives the pin.
+
+============================================================================*/
+static void pwm_publish_pulse (PWM *self, int on_usec)
+  {
+  int cycle_usec = self->cycle_usec;
+  pwm_store_timing (self, on_usec, cycle_usec - on_usec);
+  atomic_fetch_add (&self->updates, 1);
+  // A hardware PWM channel is timed by the peripheral, even in an 
+  //  engine, whose tables leave it out
+  if (self->backend == PWM_BACKEND_HWPWM)
+    pwm_hwpwm_update (self);
+  else if (self->engine)
+    pwm_engine_changed (self);
+  else if (self->backend == PWM_BACKEND_DMA)
+    pwm_dma_update (self);
+  else
+    pwm_time_unpark (&self->parked);
+  }
+
+/*============================================================================
+  pwm_set_fine_usec
+
+  Set the on-time in 1/65536 usec. Without dithering, it is rounded down
+  to a whole usec.
+
+============================================================================*/
+static void pwm_set_fine_usec (PWM *self, uint64_t fine)
+  {
+  uint64_t max = (uint64_t)self->cycle_usec << 16;
+  if (fine > max) fine = max;
+  if (pwm_dithers (self))
+    atomic_store_explicit (&self->fine, fine, memory_order_release);
+  pwm_publish_pulse (self, (int)(fine >> 16));
+  }
+
+/*============================================================================
+  pwm_set_pulse_usec
+============================================================================*/
+void pwm_set_pulse_usec (PWM *self, int on_usec)
+  {
+  assert (self != NULL);
+  if (on_usec < 0) on_usec = 0;
+  pwm_set_fine_usec (self, (uint64_t)on_usec << 16);
+  }
+
+/*============================================================================
+  pwm_set_duty_q16
+============================================================================*/
+void pwm_set_duty_q16 (PWM *self, uint32_t duty_q16)
+  {
+  assert (self != NULL);
+  if (duty_q16 > PWM_DUTY_Q16_ONE) duty_q16 = PWM_DUTY_Q16_ONE;
+  // cycle_usec is well under 2^31, so the product fits in 48 bits, and 
+  //  it is the on-time in 1/65536 usec, with nothing lost
+  pwm_set_fine_usec (self, (uint64_t)self->cycle_usec * duty_q16);
+  }
+
 /*============================================================================
   pwm_set_duty
 ============================================================================*/
 void pwm_set_duty (PWM *self, double duty)
   {
   assert (self != NULL);
-  int on_usec = (int) (self->cycle_usec * duty); 
-  int off_usec = self->cycle_usec - on_usec;
-  self->on_usec = on_usec;
-  self->off_usec = off_usec;
+  if (!(duty > 0.0)) duty = 0.0; // Including NaN
+  if (duty > 1.0) duty = 1.0;
+  pwm_set_fine_usec (self, (uint64_t)(self->cycle_usec * duty * 65536.0));
+  }
+
+/*============================================================================
+  pwm_options_init
+============================================================================*/
+void pwm_options_init (PWMOptions *options)
+  {
+  assert (options != NULL);
+  memset (options, 0, sizeof (PWMOptions));
+  options->timing = PWM_TIMING_SLEEP;
+  options->guard_usec = PWM_DEFAULT_GUARD_USEC;
+  options->rt_priority = 0;
+  options->cpu = -1;
+  options->lock_memory = FALSE;
+  options->min_pulse_usec = 0;
+  }
+
+/*============================================================================
+  pwm_options_spin_ns
+============================================================================*/
+int64_t pwm_options_spin_ns (const PWMOptions *options)
+  {
+  if (options && options->timing == PWM_TIMING_SPIN)
+    return options->guard_usec * PWM_NSEC_PER_USEC;
+  return 0;
   }
 
 /*============================================================================
@@ -125,54 +493,168 @@ void pwm_set_duty (PWM *self, double duty)
 ============================================================================*/
 BOOL pwm_start (PWM *self, int cycle_usec, char **error)
   {
+  return pwm_start_with_options (self, cycle_usec, NULL, error);
+  }
+
+/*============================================================================
+  pwm_start_with_options
+============================================================================*/
+BOOL pwm_start_with_options (PWM *self, int cycle_usec, 
+    const PWMOptions *options, char **error)
+  {
   assert (self != NULL);
+  // DMA pins have no thread; the DMA controller does the timing
+  if (self->backend == PWM_BACKEND_DMA)
+    return pwm_dma_start (self, cycle_usec, options, error);
   BOOL ret = FALSE;
+  self->cycle_usec = cycle_usec;
   if (pwm_setup_pin (self) == 0)
     {
-    self->stop = FALSE;
-    self->cycle_usec = cycle_usec;
-    self->on_usec = 0;
-    self->off_usec = cycle_usec;
-    pthread_t pt;
-    pthread_create (&pt, NULL, pwm_loop, self);
-    pthread_detach (pt); // This doesn't seem to prevent the small mem leak,
-                       //  perhaps because the application closes before the
-                       //  loop has time to complete nicely.
-    self->pthread = pt;
-    ret = TRUE;
+    atomic_store (&self->stop, FALSE);
+    self->threaded = FALSE;
+    self->spin_ns = pwm_options_spin_ns (options);
+    self->min_pulse_usec = options ? options->min_pulse_usec : 0;
+    self->level = -1;
+    self->idle = FALSE;
+    pwm_store_timing (self, 0, cycle_usec);
+    if (self->backend == PWM_BACKEND_HWPWM)
+      ret = TRUE; // The PWM peripheral does the timing
+    else if (pwm_thread_start (&self->pthread, pwm_loop, self, options, 
+        error))
+      {
+      self->threaded = TRUE;
+      ret = TRUE;
+      }
+    else
+      pwm_unsetup_pin (self);
+    self->running = ret;
+    }
+  else if (self->backend == PWM_BACKEND_HWPWM)
+    {
+    // The kernel rejects a period that the PWM clock can't make
+    pwm_set_error (error, options, "Can't set up hardware PWM on pin %d: %s",
+      self->pin, strerror (errno));
     }
   else
     {
-    if (error)
-      asprintf (error, "Can't set up pin: %s", strerror (errno));
+    pwm_set_error (error, options, "Can't set up pin: %s", strerror (errno));
     }
   return ret;
   }
 
+/*============================================================================
+  pwm_set_phase
+============================================================================*/
+void pwm_set_phase (PWM *self, int phase_usec)
+  {
+  assert (self != NULL);
+  assert (phase_usec >= 0);
+  self->phase_usec = phase_usec;
+  }
+
+/*============================================================================
+  pwm_set_dither
+============================================================================*/
+void pwm_set_dither (PWM *self, BOOL dither)
+  {
+  assert (self != NULL);
+  self->dither = dither;
+  self->dither_error = 0;
+  int on_usec, off_usec;
+  pwm_load_timing (self, &on_usec, &off_usec);
+  atomic_store_explicit (&self->fine, (uint64_t)on_usec << 16, 
+    memory_order_release);
+  }
+
+/*============================================================================
+  pwm_set_idle_timeout
+============================================================================*/
+void pwm_set_idle_timeout (PWM *self, int msec)
+  {
+  assert (self != NULL);
+  self->idle_msec = msec > 0 ? msec : 0;
+  }
+
+/*============================================================================
+  pwm_get_overruns
+============================================================================*/
+unsigned long pwm_get_overruns (const PWM *self)
+  {
+  assert (self != NULL);
+  return atomic_load_explicit (&self->overruns, memory_order_relaxed);
+  }
+
+/*============================================================================
+  pwm_get_stats
+============================================================================*/
+void pwm_get_stats (PWM *self, PWMStats *stats)
+  {
+  assert (self != NULL);
+  assert (stats != NULL);
+  pwm_stats_read (&self->stats, stats);
+  stats->overruns = pwm_get_overruns (self);
+  }
+
+/*============================================================================
+  pwm_reset_stats
+============================================================================*/
+void pwm_reset_stats (PWM *self)
+  {
+  assert (self != NULL);
+  pwm_stats_reset (&self->stats);
+  atomic_store_explicit (&self->overruns, 0, memory_order_relaxed);
+  }
+
 /*============================================================================
   pwm_stop
 ============================================================================*/
 void pwm_stop (PWM *self)
   {
   assert (self != NULL);
-  self->stop = TRUE;
+  if (self->engine) return; // The engine owns the pin
+  if (self->backend == PWM_BACKEND_DMA)
+    {
+    pwm_dma_stop (self);
+    return;
+    }
+  if (!self->running) return;
+  if (self->threaded)
+    {
+    pwm_time_interrupt (&self->stop);
+    pwm_time_unpark (&self->parked);
+    pthread_join (self->pthread, NULL);
+    self->threaded = FALSE;
+    // The thread may have stopped with the pin high
+    pwm_set_pin (self, 0);
+    }
   pwm_unsetup_pin (self);
+  self->running = FALSE;
   }
 
 /*============================================================================
   pwm_write_to_file
+
+  Write text to a sysfs attribute. Returns 0, or -1 with errno set if
+  the file can't be opened, or the kernel rejects the value -- a PWM
+  period shorter than the duty cycle, for example.
+
 ============================================================================*/
-static int pwm_write_to_file (const char *filename, const char *text)
+int pwm_write_to_file (const char *filename, const char *text)
   {
-  int ret = -1;
-  FILE *f = fopen (filename, "w");
-  if (f)
+  // Not stdio, which would allocate a buffer for the FILE
+  int fd = open (filename, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  size_t len = strlen (text);
+  ssize_t n = write (fd, text, len);
+  int saved_errno = errno;
+  close (fd);
+  if (n != (ssize_t)len)
     {
-    fprintf (f, text);
-    fclose (f);
-    ret = 0;
+    // A sysfs attribute takes the whole value or none of it
+    errno = n < 0 ? saved_errno : EIO;
+    return -1;
     }
-  return ret;
+  return 0;
   }
 
 /*============================================================================
@@ -181,6 +663,26 @@ static int pwm_write_to_file (const char *filename, const char *text)
 int pwm_set_pin (PWM *self, int value)
   {
   assert (self != NULL);
+  if (self->backend == PWM_BACKEND_GPIOMEM || self->backend == PWM_BACKEND_DMA)
+    {
+    gpiomem_write (self->pin, value);
+    return 0;
+    }
+  if (self->backend == PWM_BACKEND_CHARDEV)
+    return gpiochip_write (self->lines, self->pin, value);
+  if (self->backend == PWM_BACKEND_SIM)
+    {
+    pwm_sim_write (self->pin, value);
+    return 0;
+    }
+  if (self->backend == PWM_BACKEND_HWPWM)
+    {
+    // Fully on or fully off, in hardware
+    pwm_store_timing (self, value ? self->cycle_usec : 0, 
+      value ? 0 : self->cycle_usec);
+    pwm_hwpwm_update (self);
+    return 0;
+    }
   char v[1];
   if (value)
     v[0] = '1';
@@ -190,25 +692,73 @@ int pwm_set_pin (PWM *self, int value)
   return 0;
   }
 
+/*============================================================================
+  pwm_resolve_backend
+
+  Replace PWM_BACKEND_AUTO with the best backend that the pin and the
+  system support: hardware PWM where the pin allows it, then gpiomem,
+  then the GPIO character device, and sysfs as the last resort.
+
+============================================================================*/
+void pwm_resolve_backend (PWM *self)
+  {
+  if (self->backend != PWM_BACKEND_AUTO) return;
+  if (pwm_hwpwm_available (self->pin))
+    self->backend = PWM_BACKEND_HWPWM;
+  else if (access ("/dev/gpiomem", R_OK | W_OK) == 0)
+    self->backend = PWM_BACKEND_GPIOMEM;
+  else if (access (GPIOCHIP_DEVICE, R_OK | W_OK) == 0)
+    self->backend = PWM_BACKEND_CHARDEV;
+  else
+    self->backend = PWM_BACKEND_SYSFS;
+  }
+
+/*============================================================================
+  pwm_get_backend
+============================================================================*/
+PWMBackend pwm_get_backend (const PWM *self)
+  {
+  assert (self != NULL);
+  return self->backend;
+  }
+
 /*============================================================================
   pwm_setup_pin
 ============================================================================*/
 int pwm_setup_pin (PWM *self)
   {
   assert (self != NULL);
-  char s[50];
-  snprintf (s, sizeof(s), "%d", self->pin);
-  int ret = pwm_write_to_file ("/sys/class/gpio/export", s);
-  if (ret == 0)
+  pwm_resolve_backend (self);
+  if (self->backend == PWM_BACKEND_HWPWM)
+    return pwm_hwpwm_setup (self);
+  if (self->backend == PWM_BACKEND_SIM)
+    return pwm_sim_setup (self->pin);
+  if (self->backend == PWM_BACKEND_CHARDEV)
     {
-    char s[50];
-    snprintf (s, sizeof(s), "/sys/class/gpio/gpio%d/direction", self->pin);
-    pwm_write_to_file (s, "out");
-    snprintf (s, sizeof(s), "/sys/class/gpio/gpio%d/value", self->pin);
-    self->f_value = open (s, O_WRONLY);
-    if (self->f_value >= 0) ret = 0;
+    // An engine may already have requested the line, with all its others
+    if (self->lines) return 0; 
+    self->lines = gpiochip_request (&self->pin, 1);
+    self->own_lines = TRUE;
+    return self->lines ? 0 : -1;
     }
-  return ret;
+  if (self->backend == PWM_BACKEND_GPIOMEM)
+    {
+    if (self->pin < 0 || self->pin > GPIOMEM_MAX_PIN)
+      {
+      errno = EINVAL;
+      return -1;
+      }
+    int ret = gpiomem_open ();
+    if (ret == 0)
+      {
+      gpiomem_write (self->pin, 0);
+      gpiomem_set_output (self->pin);
+      }
+    return ret;
+    }
+  // An engine may already have set up the pin, with all its others
+  if (self->f_value >= 0) return 0;
+  return pwm_sysfs_setup (&self, 1);
   }
 
 /*============================================================================
@@ -217,13 +767,31 @@ int pwm_setup_pin (PWM *self)
 int pwm_unsetup_pin (PWM *self)
   {
   assert (self != NULL);
-  char s[50];
-  snprintf (s, sizeof(s), "%d", self->pin);
-  int ret = pwm_write_to_file ("/sys/class/gpio/unexport", s);
-  if (self->f_value >= 0)
-    close (self->f_value);
-  self->f_value = -1;
-  return ret;
+  if (self->backend == PWM_BACKEND_HWPWM)
+    return pwm_hwpwm_unsetup (self);
+  if (self->backend == PWM_BACKEND_SIM)
+    return 0; // pwm_stop() has already left it low
+  if (self->backend == PWM_BACKEND_CHARDEV)
+    {
+    if (self->lines)
+      {
+      gpiochip_write (self->lines, self->pin, 0);
+      if (self->own_lines)
+        gpiochip_release (self->lines);
+      }
+    self->lines = NULL;
+    self->own_lines = FALSE;
+    return 0;
+    }
+  if (self->backend == PWM_BACKEND_GPIOMEM)
+    {
+    // There's nothing to release -- the register mapping is shared, and
+    //  kept. Just make sure the output is left low.
+    if (gpiomem_regs)
+      gpiomem_write (self->pin, 0);
+    return 0;
+    }
+  return pwm_sysfs_unsetup (self);
   }
 
 
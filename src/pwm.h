@@ -10,15 +10,128 @@
   ==========================================================================*/
 #pragma once
 
-struct PWM;
+#include <stddef.h>
+#include <stdint.h>
+
+struct _PWM;
 typedef struct _PWM PWM;
 
+// The number of PWM instances that pwm_pool_create() can hand out. The
+//  pool is static, so this is fixed when the library is built
+#ifndef PWM_POOL_SIZE
+#define PWM_POOL_SIZE 64
+#endif
+
+// Full duty -- always high -- in the Q16 form taken by pwm_set_duty_q16()
+#define PWM_DUTY_Q16_ONE 0x10000
+
+// The means by which a PWM instance drives its GPIO pin
+typedef enum
+  {
+  // Write '0' or '1' to /sys/class/gpio/gpioN/value -- one system call
+  //  per edge, but works on any kernel with sysfs GPIO
+  PWM_BACKEND_SYSFS = 0,
+  // Store directly to the GPSET/GPCLR registers, mapped through
+  //  /dev/gpiomem. No system calls at all once the pin is set up
+  PWM_BACKEND_GPIOMEM,
+  // Have the DMA controller write GPSET/GPCLR from a precomputed 
+  //  waveform, paced by the PWM peripheral. No thread, and almost no 
+  //  CPU, at any frequency. Needs root. All DMA pins share one cycle 
+  //  length, and on-times are rounded down to 10 usec steps
+  PWM_BACKEND_DMA,
+  // The PWM peripheral, through /sys/class/pwm. Only GPIO 12, 13, 18 
+  //  and 19 can use it, and only when routed by a device tree overlay
+  PWM_BACKEND_HWPWM,
+  // The GPIO character device, /dev/gpiochip0, through its v2 ioctls.
+  //  One system call per edge, like sysfs, but no export step, and an 
+  //  engine sets all its pins that change together with one ioctl
+  PWM_BACKEND_CHARDEV,
+  // No GPIO at all: each edge is timestamped and logged in memory, for 
+  //  reading with pwm_sim_read_edges() (see pwm_sim.h). Pins 0-63. For
+  //  testing and measuring the timing threads on any Linux machine
+  PWM_BACKEND_SIM,
+  // Choose when the PWM starts: hardware PWM if the pin supports it, 
+  //  otherwise gpiomem if /dev/gpiomem is accessible, otherwise the
+  //  character device if that is, otherwise sysfs
+  PWM_BACKEND_AUTO
+  } PWMBackend;
+
+// How the timing thread waits for each edge
+typedef enum
+  {
+  // Sleep until the edge is due. Uses almost no CPU, but the edge will be
+  //  late by however long the scheduler takes to wake the thread
+  PWM_TIMING_SLEEP = 0,
+  // Sleep until guard_usec before the edge, then busy-wait on the clock.
+  //  Much more accurate, but uses the CPU for guard_usec per edge
+  PWM_TIMING_SPIN
+  } PWMTiming;
+
+// Default guard interval for PWM_TIMING_SPIN -- a little more than
+//  the worst wakeup latency that is typical of an idle Pi
+#define PWM_DEFAULT_GUARD_USEC 150
+
+// Options that can be set when starting PWM. Always initialize with 
+//  pwm_options_init(), so that fields added later get their defaults
+typedef struct _PWMOptions
+  {
+  PWMTiming timing;
+  int guard_usec; // Busy-wait interval for PWM_TIMING_SPIN
+  int rt_priority; // SCHED_FIFO priority 1-99, or 0 for normal scheduling
+  int cpu; // CPU to run the timing thread on, or -1 for any
+  BOOL lock_memory; // Lock all the process's memory with mlockall()
+  // Pulses, or gaps between pulses, shorter than this are dropped, 
+  //  making the output fully off, or fully on. Set it to about the 
+  //  timing resolution of the backend, e.g. 20-50 usec for sysfs. The 
+  //  default, zero, never drops a pulse
+  int min_pulse_usec; 
+  // If set, an error from starting the PWM, or an engine, is written 
+  //  here, truncated to error_size bytes, in place of allocating *error.
+  //  Use this to keep the start path free of heap allocation
+  char *error_buf;
+  size_t error_size;
+  } PWMOptions;
+
+// Edge-timing statistics, from pwm_get_stats(). Lateness is the time
+//  from when an edge was scheduled to when the timing thread finished 
+//  writing it, so it includes the cost of the write itself
+typedef struct _PWMStats
+  {
+  unsigned long cycles; // Cycles run
+  unsigned long edges; // Edges written, and timed
+  unsigned long overruns; // As pwm_get_overruns()
+  int64_t min_late_ns; // Best edge
+  int64_t max_late_ns; // Worst edge
+  // Median and 99th percentile, from a histogram, so accurate to 1 usec 
+  //  up to 64 usec, and to within 1/8 of the value above that
+  int64_t p50_late_ns; 
+  int64_t p99_late_ns;
+  } PWMStats;
+
 BEGIN_DECLS
 
+/** Fill in PWMOptions with the defaults, which give the same behaviour as
+    pwm_start(). */
+void     pwm_options_init (PWMOptions *options);
+
 /** Create a PWM instance. This method only initializes and allocates 
-    memory, so it will always succed. Call pwm_destroy() when finished. */
+    memory, so it will always succed. Call pwm_destroy() when finished. 
+    The instance uses the sysfs backend. */
 PWM     *pwm_create (int pin);
 
+/** As pwm_create(), but selects the way the pin will be driven. Whether
+    the backend is actually usable is not known until pwm_start(). */
+PWM     *pwm_create_backend (int pin, PWMBackend backend);
+
+/** As pwm_create_backend(), but the instance comes from a static pool of
+    PWM_POOL_SIZE, rather than from the heap. Returns NULL if the pool is
+    exhausted. pwm_destroy() returns the instance to the pool. */
+PWM     *pwm_pool_create (int pin, PWMBackend backend);
+
+/** The backend in use. For PWM_BACKEND_AUTO, this is the backend that
+    was chosen, once the PWM has been started. */
+PWMBackend pwm_get_backend (const PWM *self);
+
 /** Tidy up this PWM instance. Implicitly calls pwm_stop(). */
 void     pwm_destroy (PWM *pwm);
 
@@ -28,10 +141,80 @@ void     pwm_destroy (PWM *pwm);
     length, in microseconds. */
 BOOL     pwm_start (PWM *self, int cycle_usec, char **error);
 
-/** Stop the PWM thread, and uninitialze the GPIO. */
+/** As pwm_start(), but with options. options may be NULL, which is the
+    same as calling pwm_start(). If a real-time priority, CPU, or memory
+    locking is requested and can't be had, the PWM is not started, and
+    *error says why -- or options->error_buf does, if that is set, and
+    *error is left alone. */
+BOOL     pwm_start_with_options (PWM *self, int cycle_usec, 
+           const PWMOptions *options, char **error);
+
+/** Stop the PWM thread, waiting for it to exit, leave the pin low, and 
+    uninitialize the GPIO. The thread is woken at once, so this doesn't
+    wait for the end of the cycle. This does nothing if
+    the instance has been added to a PWMEngine -- stop the engine 
+    instead. */
 void     pwm_stop (PWM *self);
 
-/** Set the PWM output level, as a fraction from 0.0 (off) to 1.0 (high). */
+/** Set the PWM output level, as a fraction from 0.0 (off) to 1.0 (high). 
+    This may be called from any thread; the new level takes effect at the
+    start of the next cycle. */
 void     pwm_set_duty (PWM *self, double duty);
 
+/** Set the PWM output level as an on-time, in usec, within the cycle
+    given to pwm_start(). Values outside 0..cycle_usec are clamped. This
+    does no floating-point arithmetic, and is otherwise the same as 
+    pwm_set_duty(). */
+void     pwm_set_pulse_usec (PWM *self, int on_usec);
+
+/** Set the PWM output level as a 16.16 fixed-point fraction, from 0 (off)
+    to PWM_DUTY_Q16_ONE (high). Larger values are clamped. Like 
+    pwm_set_pulse_usec(), this uses only integer arithmetic. */
+void     pwm_set_duty_q16 (PWM *self, uint32_t duty_q16);
+
+/** Set the point in the cycle, in usec from its start, at which this
+    PWM's pulse starts. This is only used when the PWM is driven by a
+    PWMEngine, and must be set before the engine is started. */
+void     pwm_set_phase (PWM *self, int phase_usec);
+
+/** Dither the on-time. Without dithering, pwm_set_duty() and 
+    pwm_set_duty_q16() round the on-time down to a whole usec, so a
+    200 usec cycle has only 200 levels. With it, the timing thread 
+    rounds each cycle's on-time up or down so that the errors cancel
+    out, and the average on-time is within 1/65536 usec of the one asked
+    for. This costs a little work per cycle, and for a PWMEngine a table
+    rebuild in most cycles. It has no effect on the DMA and hardware PWM
+    backends. Set it before the PWM is started, or its engine is. */
+void     pwm_set_dither (PWM *self, BOOL dither);
+
+/** Stop pulsing, and leave the pin low, once the PWM has gone msec
+    milliseconds without its on-time being set -- say, for a servo 
+    that holds its position well enough unpowered, to save the power, 
+    the wakeups, and the servo's own jitter. Any call that sets the 
+    on-time, even to the value it had, starts the pulses again, at the
+    start of the next cycle. A move in progress counts as setting it.
+    Zero, the default, never stops. It has no effect on the DMA and 
+    hardware PWM backends. Set it before the PWM is started, or its 
+    engine is.
+
+    A PWM that is fully on or fully off is idle anyway: its timing 
+    thread, or its engine, stops waking up for it until it is set
+    again, with or without a timeout, and meanwhile its statistics 
+    count no cycles. */
+void     pwm_set_idle_timeout (PWM *self, int msec);
+
+/** The number of edges that were missed because the timing thread woke
+    up after the following edge on this pin was already due. On a 
+    lightly-loaded system this should stay at zero. */
+unsigned long pwm_get_overruns (const PWM *self);
+
+/** Read the edge-timing statistics that the timing thread keeps for this
+    PWM. They are collected all the time, at the cost of a clock read 
+    and a few counter updates per edge. Backends with no timing thread 
+    -- DMA, and stand-alone hardware PWM -- have no statistics. */
+void     pwm_get_stats (PWM *self, PWMStats *stats);
+
+/** Zero the statistics, including the overrun count. */
+void     pwm_reset_stats (PWM *self);
+
 END_DECLS
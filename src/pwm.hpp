@@ -0,0 +1,307 @@
+/*============================================================================
+
+  pwm.hpp
+
+  A header-only C++ layer over the PWM library, for applications written
+  in C++. Each class owns the C object it wraps, and stops and frees it
+  when it goes out of scope, so a PWM can't be left running -- and its
+  pin high -- by an exception or an early return. Failures to start are
+  thrown as pi_servo::Error, with the library's message.
+
+  The backend is a template parameter, so it is fixed at compile time,
+  and calls that make no sense for it -- adding a DMA channel to an
+  engine, or dithering a backend with no timing thread -- fail to
+  compile, rather than doing nothing at run time. Every method is an
+  inline, direct call into the C library; there are no virtual
+  functions. GpioPin gives direct register access to a pin whose number
+  is known at compile time, with the register offsets and bit mask
+  worked out by the compiler, so that each write is a single store.
+
+  For example:
+
+  pi_servo::Pwm<PWM_BACKEND_GPIOMEM> pan (17), tilt (18);
+  pi_servo::Engine engine (20000);
+  engine.add (pan);
+  engine.add (tilt);
+  engine.start ();
+  pi_servo::Servo servo (pan);
+  servo.move_to (1500, 1000);
+
+  An Engine stops when it is destroyed, but the PWMs it drives must
+  outlive it, so declare them first, as above. pi_servo::Servo has the
+  same name as the C library's Servo, so it has to be qualified, even
+  after "using namespace pi_servo".
+
+  The library's public headers, which this one includes, compile as C++
+  too, as does pwm_shm_segment.h, for a shared-memory client. The 
+  internal ones -- pwm_internal.h, pwm_stats.h and pwm_time.h -- use C11
+  atomic types, and are only for the library's own sources.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include "defs.h"
+#include "pwm.h"
+#include "pwm_engine.h"
+#include "servo.h"
+#include "gpiomem.h"
+#include "pwm_shm_segment.h"
+
+namespace pi_servo
+{
+
+// Thrown when a PWM, an engine, or the GPIO registers can't be set up
+class Error : public std::runtime_error
+  {
+  public:
+    explicit Error (const std::string &message)
+      : std::runtime_error (message) {}
+  };
+
+/*============================================================================
+  throw_error
+
+  Throw the library's message, which the caller passed to it as *error,
+  freeing it first.
+
+============================================================================*/
+inline void throw_error (char *error, const char *what)
+  {
+  std::string message (what);
+  if (error)
+    {
+    message += ": ";
+    message += error;
+    free (error);
+    }
+  throw Error (message);
+  }
+
+/*============================================================================
+  Pwm
+
+  One PWM channel on the given backend. It can be started on its own,
+  by the constructor that takes a cycle length, or by start(), or
+  handed to an Engine and started by that.
+
+============================================================================*/
+template <PWMBackend Backend>
+class Pwm
+  {
+  public:
+    static constexpr PWMBackend backend = Backend;
+    // Whether a thread does the timing, so that the on-time can be
+    //  ramped, dithered and timed out. The DMA controller, and the PWM
+    //  peripheral, time their pins themselves
+    static constexpr bool timed_by_thread = Backend != PWM_BACKEND_DMA
+      && Backend != PWM_BACKEND_HWPWM;
+
+    /** Create the channel, without starting it. */
+    explicit Pwm (int pin) : pwm (pwm_create_backend (pin, Backend)) {}
+
+    /** Create the channel, and start it with the given cycle length,
+        in usec. */
+    Pwm (int pin, int cycle_usec, const PWMOptions *options = nullptr)
+        : Pwm (pin)
+      {
+      start (cycle_usec, options);
+      }
+
+    ~Pwm () { pwm_destroy (pwm); }
+
+    Pwm (const Pwm &) = delete;
+    Pwm &operator= (const Pwm &) = delete;
+    Pwm (Pwm &&other) noexcept : pwm (other.pwm) { other.pwm = nullptr; }
+    Pwm &operator= (Pwm &&other) noexcept
+      {
+      if (this != &other)
+        {
+        pwm_destroy (pwm);
+        pwm = other.pwm;
+        other.pwm = nullptr;
+        }
+      return *this;
+      }
+
+    /** As pwm_start_with_options(), but throws on failure. */
+    void start (int cycle_usec, const PWMOptions *options = nullptr)
+      {
+      char *error = nullptr;
+      if (!pwm_start_with_options (pwm, cycle_usec, options, &error))
+        throw_error (error, "Can't start PWM");
+      }
+
+    void stop () { pwm_stop (pwm); }
+
+    void set_duty (double duty) { pwm_set_duty (pwm, duty); }
+    void set_pulse_usec (int on_usec) { pwm_set_pulse_usec (pwm, on_usec); }
+    void set_duty_q16 (uint32_t duty_q16)
+      {
+      pwm_set_duty_q16 (pwm, duty_q16);
+      }
+    void set_phase (int phase_usec) { pwm_set_phase (pwm, phase_usec); }
+
+    void set_dither (bool dither)
+      {
+      static_assert (timed_by_thread, "This backend can't dither");
+      pwm_set_dither (pwm, dither);
+      }
+
+    void set_idle_timeout (int msec)
+      {
+      static_assert (timed_by_thread, "This backend has no idle timeout");
+      pwm_set_idle_timeout (pwm, msec);
+      }
+
+    PWMStats stats () const
+      {
+      PWMStats s;
+      pwm_get_stats (pwm, &s);
+      return s;
+      }
+    void reset_stats () { pwm_reset_stats (pwm); }
+    unsigned long overruns () const { return pwm_get_overruns (pwm); }
+
+    /** The C object, for calls that this layer doesn't wrap. It still
+        belongs to this Pwm. */
+    PWM *get () const { return pwm; }
+
+  private:
+    PWM *pwm;
+  };
+
+/*============================================================================
+  Engine
+
+  One timing thread for many channels (see pwm_engine.h).
+
+============================================================================*/
+class Engine
+  {
+  public:
+    explicit Engine (int cycle_usec)
+      : engine (pwm_engine_create (cycle_usec)) {}
+    ~Engine () { pwm_engine_destroy (engine); }
+
+    Engine (const Engine &) = delete;
+    Engine &operator= (const Engine &) = delete;
+
+    /** Add a channel with the engine's cycle length, or its own. Throws
+        if the engine is running or full. A hardware PWM channel, or an
+        automatic one that turns out to be, is timed by the peripheral,
+        and the engine passes its duty on. */
+    template <PWMBackend Backend>
+    void add (Pwm<Backend> &pwm, int cycle_usec = 0)
+      {
+      static_assert (Backend != PWM_BACKEND_DMA,
+        "DMA channels do their own timing, and can't join an engine");
+      BOOL added = cycle_usec > 0
+        ? pwm_engine_add_with_cycle (engine, pwm.get (), cycle_usec)
+        : pwm_engine_add (engine, pwm.get ());
+      if (!added) throw Error ("Can't add PWM to engine");
+      }
+
+    void set_phase_mode (PWMPhaseMode mode)
+      {
+      if (!pwm_engine_set_phase_mode (engine, mode))
+        throw Error ("Can't set the phase mode of a running engine");
+      }
+
+    /** As pwm_engine_start_with_options(), but throws on failure. */
+    void start (const PWMOptions *options = nullptr)
+      {
+      char *error = nullptr;
+      if (!pwm_engine_start_with_options (engine, options, &error))
+        throw_error (error, "Can't start PWM engine");
+      }
+
+    void stop () { pwm_engine_stop (engine); }
+    unsigned long overruns () const
+      {
+      return pwm_engine_get_overruns (engine);
+      }
+    PWMEngine *get () const { return engine; }
+
+  private:
+    PWMEngine *engine;
+  };
+
+/*============================================================================
+  Servo
+
+  A hobby servo on a Pwm (see servo.h), which must outlive it.
+
+============================================================================*/
+class Servo
+  {
+  public:
+    template <PWMBackend Backend>
+    explicit Servo (Pwm<Backend> &pwm) : servo (servo_create (pwm.get ())) {}
+    ~Servo () { servo_destroy (servo); }
+
+    Servo (const Servo &) = delete;
+    Servo &operator= (const Servo &) = delete;
+
+    void set_range (int min_usec, int max_usec)
+      {
+      servo_set_range (servo, min_usec, max_usec);
+      }
+    void set_max_rate (int max_usec_per_sec)
+      {
+      servo_set_max_rate (servo, max_usec_per_sec);
+      }
+    void set_idle_timeout (int msec) { servo_set_idle_timeout (servo, msec); }
+    void move_to (int target_usec, int duration_msec = 0)
+      {
+      servo_move_to (servo, target_usec, duration_msec);
+      }
+    int pulse_usec () const { return servo_get_pulse_usec (servo); }
+
+  private:
+    ::Servo *servo;
+  };
+
+/*============================================================================
+  GpioPin
+
+  Direct access to one pin through the GPIO registers, as gpiomem.h
+  gives, but with the pin number as a template parameter, so that the
+  register offsets and the bit mask are constants, and each write
+  compiles to one store of an immediate to a fixed address. This is for
+  pins that the application drives itself -- a trigger, or an enable
+  line -- not for pins that a PWM is driving, which its timing thread
+  writes.
+
+============================================================================*/
+template <int Pin>
+class GpioPin
+  {
+  public:
+    static_assert (Pin >= 0 && Pin <= GPIOMEM_MAX_PIN,
+      "No such pin on the BCM283x");
+    static constexpr int set_offset = GPIOMEM_GPSET0 + (Pin >> 5);
+    static constexpr int clr_offset = GPIOMEM_GPCLR0 + (Pin >> 5);
+    static constexpr uint32_t mask = 1u << (Pin & 31);
+
+    /** Map the registers, if they aren't already, and make the pin an
+        output. Throws if /dev/gpiomem can't be mapped. */
+    GpioPin ()
+      {
+      if (gpiomem_open () != 0) throw Error ("Can't map the GPIO registers");
+      gpiomem_set_output (Pin);
+      }
+
+    static void set () { gpiomem_regs[set_offset] = mask; }
+    static void clear () { gpiomem_regs[clr_offset] = mask; }
+    static void write (bool level) { level ? set () : clear (); }
+  };
+
+} // namespace pi_servo
+
@@ -0,0 +1,479 @@
+/*==========================================================================
+  
+    pwm_dma.c
+
+    PWM driven by the BCM283x DMA controller, rather than by a thread.
+    
+    The cycle is divided into samples, PWM_DMA_STEP_USEC long. For each
+    sample there is a pair of DMA control blocks: the first copies a set
+    mask and a clear mask to GPSET0..GPCLR1, and the second writes one 
+    word to the PWM peripheral's FIFO. The PWM peripheral isn't driving 
+    any pin; it is just clocked so that its FIFO takes one word per
+    sample, and since the second control block waits for the PWM's DREQ
+    signal, it paces the chain. The last control block links back to 
+    the first, so the waveform repeats forever with no CPU involvement.
+
+    Setting the duty doesn't touch the control blocks at all: it moves
+    the pin's bit from one sample's clear mask to another's.
+
+    Because the PWM peripheral is used for pacing, DMA PWM can't be used
+    at the same time as analogue audio, or the hardware PWM backend.
+    This backend needs root, for /dev/mem.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_internal.h" 
+#include "pwm_dma.h" 
+#include "gpiomem.h" 
+#include "mailbox.h" 
+
+// Peripheral addresses, as seen by the DMA controller on the VC bus
+#define BUS_PERI_BASE 0x7E000000
+#define BUS_GPSET0 (BUS_PERI_BASE + 0x20001C)
+#define BUS_PWM_FIF1 (BUS_PERI_BASE + 0x20C018)
+
+// Offsets of the peripheral blocks from the physical peripheral base
+#define DMA_OFFSET 0x007000
+#define CLK_OFFSET 0x101000
+#define PWM_OFFSET 0x20C000
+
+// DMA channel registers (word offsets), and their bits
+#define DMA_CS 0
+#define DMA_CONBLK_AD 1
+#define DMA_DEBUG 8
+#define DMA_CS_ACTIVE (1u << 0)
+#define DMA_CS_END (1u << 1)
+#define DMA_CS_INT (1u << 2)
+#define DMA_CS_PRIORITY(x) ((uint32_t)(x) << 16)
+#define DMA_CS_PANIC_PRIORITY(x) ((uint32_t)(x) << 20)
+#define DMA_CS_WAIT_WRITES (1u << 28)
+#define DMA_CS_RESET (1u << 31)
+#define DMA_TI_WAIT_RESP (1u << 3)
+#define DMA_TI_DEST_INC (1u << 4)
+#define DMA_TI_DEST_DREQ (1u << 6)
+#define DMA_TI_SRC_INC (1u << 8)
+#define DMA_TI_PERMAP(x) ((uint32_t)(x) << 16)
+#define DMA_TI_NO_WIDE_BURSTS (1u << 26)
+#define DMA_PERMAP_PWM 5
+
+// PWM registers (word offsets), and their bits
+#define PWM_CTL 0
+#define PWM_DMAC 2
+#define PWM_RNG1 4
+#define PWM_CTL_PWEN1 (1u << 0)
+#define PWM_CTL_USEF1 (1u << 5)
+#define PWM_CTL_CLRF1 (1u << 6)
+#define PWM_DMAC_ENAB (1u << 31)
+#define PWM_DMAC_PANIC(x) ((uint32_t)(x) << 8)
+#define PWM_DMAC_DREQ(x) ((uint32_t)(x))
+
+// Clock manager registers for the PWM clock (word offsets), and bits
+#define CLK_PWMCTL 40
+#define CLK_PWMDIV 41
+#define CLK_PASSWD 0x5A000000
+#define CLK_CTL_SRC_PLLD 6
+#define CLK_CTL_ENAB (1u << 4)
+#define CLK_CTL_BUSY (1u << 7)
+
+// The PWM clock is divided down from PLLD to this rate, and the PWM
+//  range is set so that the FIFO drains one word per sample
+#define PWM_CLOCK_HZ 10000000
+
+// A DMA control block. The controller requires 32-byte alignment
+typedef struct _DMACB
+  {
+  uint32_t ti; // Transfer information
+  uint32_t source_ad;
+  uint32_t dest_ad;
+  uint32_t txfr_len;
+  uint32_t stride;
+  uint32_t nextconbk;
+  uint32_t pad[2];
+  } DMACB;
+
+// The words copied to GPSET0, GPSET1, (reserved), GPCLR0, GPCLR1 at each
+//  sample. Padded to 32 bytes, to keep every slot in one burst
+typedef struct _DMASlot
+  {
+  uint32_t set[2];
+  uint32_t reserved;
+  uint32_t clr[2];
+  uint32_t pad[3];
+  } DMASlot;
+
+#define DMA_SLOT_LEN 20 // Bytes of DMASlot copied to the GPIO registers
+
+// The state of the (single) DMA waveform
+typedef struct _PWMDMA
+  {
+  int users; // Number of pins in the waveform
+  int cycle_usec;
+  int samples; // Samples per cycle
+  int mbox; // Mailbox fd
+  uint32_t mem_handle; // GPU memory handle
+  uint32_t mem_bus; // Bus address of the memory
+  size_t mem_size;
+  void *mem; // The memory, mapped uncached into our address space
+  DMACB *cbs; // 2 * samples control blocks
+  volatile DMASlot *slots; // samples mask slots 
+  void *dma_block; // Mapping of the DMA block
+  volatile uint32_t *dma_reg; // Our channel's registers, within dma_block
+  volatile uint32_t *pwm_reg;
+  volatile uint32_t *clk_reg;
+  int fall[GPIOMEM_MAX_PIN + 1]; // Sample of each pin's falling edge, or -1
+  BOOL rise[GPIOMEM_MAX_PIN + 1]; // Whether each pin rises at sample 0
+  BOOL used[GPIOMEM_MAX_PIN + 1]; // Whether each pin is in the waveform
+  } PWMDMA;
+
+static PWMDMA pwm_dma = { .mbox = -1 };
+
+// Serializes starting, stopping, and patching the waveform, which may be
+//  done by different threads for different pins
+static pthread_mutex_t pwm_dma_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*============================================================================
+  pwm_dma_peripheral_base
+
+  Find the physical address of the peripherals from the device tree,
+  which is the only reliable way to tell a Pi 1 from a 2/3 from a 4.
+
+============================================================================*/
+static uint32_t pwm_dma_peripheral_base (void)
+  {
+  uint32_t base = 0x20000000; // Pi 1 and Zero
+  FILE *f = fopen ("/proc/device-tree/soc/ranges", "rb");
+  if (f)
+    {
+    unsigned char b[12];
+    size_t n = fread (b, 1, sizeof (b), f);
+    if (n >= 8)
+      base = (uint32_t)b[4] << 24 | b[5] << 16 | b[6] << 8 | b[7];
+    // On the Pi 4 the parent (ARM physical) address is two cells, and 
+    //  the first, its high half, is 0, so the base is in the second
+    if (base == 0 && n >= 12)
+      base = (uint32_t)b[8] << 24 | b[9] << 16 | b[10] << 8 | b[11];
+    fclose (f);
+    }
+  return base;
+  }
+
+/*============================================================================
+  pwm_dma_map
+
+  Map a range of physical memory through /dev/mem. Returns NULL on
+  failure, with errno set.
+
+============================================================================*/
+static void *pwm_dma_map (uint32_t phys, size_t size)
+  {
+  int fd = open ("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
+  if (fd < 0) return NULL;
+  void *map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, phys);
+  int saved_errno = errno;
+  close (fd);
+  errno = saved_errno;
+  return map == MAP_FAILED ? NULL : map;
+  }
+
+/*============================================================================
+  pwm_dma_bus
+
+  The bus address of something in the waveform memory.
+============================================================================*/
+static uint32_t pwm_dma_bus (const volatile void *p)
+  {
+  return pwm_dma.mem_bus 
+    + (uint32_t)((const volatile char *)p - (char *)pwm_dma.mem);
+  }
+
+/*============================================================================
+  pwm_dma_release
+
+  Free everything pwm_dma_init() allocated. Safe to call on partly-
+  initialized state.
+
+============================================================================*/
+static void pwm_dma_release (void)
+  {
+  // dma_reg is only set once all the registers are mapped; until then,
+  //  we have touched none of them, and the DMA block's other channels 
+  //  belong to the firmware and the kernel
+  if (pwm_dma.dma_reg) 
+    {
+    pwm_dma.dma_reg[DMA_CS] = DMA_CS_RESET;
+    usleep (10);
+    pwm_dma.pwm_reg[PWM_CTL] = 0;
+    }
+  if (pwm_dma.mem) munmap (pwm_dma.mem, pwm_dma.mem_size);
+  if (pwm_dma.mem_bus) mailbox_mem_unlock (pwm_dma.mbox, pwm_dma.mem_handle);
+  if (pwm_dma.mem_handle) mailbox_mem_free (pwm_dma.mbox, pwm_dma.mem_handle);
+  mailbox_close (pwm_dma.mbox);
+  if (pwm_dma.dma_block) munmap (pwm_dma.dma_block, 4096);
+  if (pwm_dma.pwm_reg) munmap ((void *)pwm_dma.pwm_reg, 4096);
+  if (pwm_dma.clk_reg) munmap ((void *)pwm_dma.clk_reg, 4096);
+  memset (&pwm_dma, 0, sizeof (pwm_dma));
+  pwm_dma.mbox = -1;
+  }
+
+/*============================================================================
+  pwm_dma_init
+
+  Allocate the waveform memory, build the control block chain, and set
+  the DMA controller running. Initially every mask is empty, so the
+  chain runs without touching any pin.
+
+============================================================================*/
+static BOOL pwm_dma_init (int cycle_usec, const PWMOptions *options, 
+    char **error)
+  {
+  uint32_t peri = pwm_dma_peripheral_base ();
+  int samples = cycle_usec / PWM_DMA_STEP_USEC;
+  if (samples < 2)
+    {
+    pwm_set_error (error, options, "DMA PWM cycle must be at least %d usec",
+      2 * PWM_DMA_STEP_USEC);
+    return FALSE;
+    }
+
+  if (gpiomem_open () != 0)
+    {
+    pwm_set_error (error, options, "Can't map GPIO registers: %s",
+      strerror (errno));
+    return FALSE;
+    }
+
+  pwm_dma.dma_block = pwm_dma_map (peri + DMA_OFFSET, 4096);
+  pwm_dma.pwm_reg = pwm_dma_map (peri + PWM_OFFSET, 4096);
+  pwm_dma.clk_reg = pwm_dma_map (peri + CLK_OFFSET, 4096);
+  if (!pwm_dma.dma_block || !pwm_dma.pwm_reg || !pwm_dma.clk_reg)
+    {
+    pwm_set_error (error, options, 
+      "Can't map peripherals through /dev/mem: %s", strerror (errno));
+    pwm_dma_release ();
+    return FALSE;
+    }
+  pwm_dma.dma_reg = (volatile uint32_t *)((uint8_t *)pwm_dma.dma_block 
+    + PWM_DMA_CHANNEL * 0x100);
+
+  pwm_dma.mbox = mailbox_open ();
+  if (pwm_dma.mbox < 0)
+    {
+    pwm_set_error (error, options, "Can't open /dev/vcio: %s",
+      strerror (errno));
+    pwm_dma_release ();
+    return FALSE;
+    }
+
+  size_t size = samples * (2 * sizeof (DMACB) + sizeof (DMASlot)) + 32;
+  size = (size + 4095) & ~(size_t)4095;
+  uint32_t flags = peri == 0x20000000 
+    ? MAILBOX_MEM_FLAG_L1_NONALLOCATING : MAILBOX_MEM_FLAG_DIRECT;
+  pwm_dma.mem_size = size;
+  pwm_dma.mem_handle = mailbox_mem_alloc (pwm_dma.mbox, size, 4096, flags);
+  if (pwm_dma.mem_handle)
+    pwm_dma.mem_bus = mailbox_mem_lock (pwm_dma.mbox, pwm_dma.mem_handle);
+  if (pwm_dma.mem_bus)
+    pwm_dma.mem = pwm_dma_map (pwm_dma.mem_bus & ~0xC0000000, size);
+  if (!pwm_dma.mem)
+    {
+    pwm_set_error (error, options, "Can't allocate %zu bytes of DMA memory",
+      size);
+    pwm_dma_release ();
+    return FALSE;
+    }
+  memset (pwm_dma.mem, 0, size);
+
+  pwm_dma.cycle_usec = cycle_usec;
+  pwm_dma.samples = samples;
+  pwm_dma.cbs = (DMACB *)pwm_dma.mem;
+  pwm_dma.slots = (volatile DMASlot *)(pwm_dma.cbs + 2 * samples);
+  volatile uint32_t *pace = (volatile uint32_t *)(pwm_dma.slots + samples);
+  for (int pin = 0; pin <= GPIOMEM_MAX_PIN; pin++)
+    pwm_dma.fall[pin] = -1;
+
+  for (int i = 0; i < samples; i++)
+    {
+    DMACB *gpio = &pwm_dma.cbs[2 * i];
+    DMACB *delay = &pwm_dma.cbs[2 * i + 1];
+    gpio->ti = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP 
+      | DMA_TI_SRC_INC | DMA_TI_DEST_INC;
+    gpio->source_ad = pwm_dma_bus (&pwm_dma.slots[i]);
+    gpio->dest_ad = BUS_GPSET0;
+    gpio->txfr_len = DMA_SLOT_LEN;
+    gpio->nextconbk = pwm_dma_bus (delay);
+    delay->ti = DMA_TI_NO_WIDE_BURSTS | DMA_TI_WAIT_RESP 
+      | DMA_TI_DEST_DREQ | DMA_TI_PERMAP (DMA_PERMAP_PWM);
+    delay->source_ad = pwm_dma_bus (pace);
+    delay->dest_ad = BUS_PWM_FIF1;
+    delay->txfr_len = 4;
+    delay->nextconbk = pwm_dma_bus (&pwm_dma.cbs[2 * ((i + 1) % samples)]);
+    }
+
+  // PWM clock: PLLD is 750MHz on the Pi 4, and 500MHz on earlier models
+  uint32_t plld_hz = peri == 0xFE000000 ? 750000000 : 500000000;
+  volatile uint32_t *clk = pwm_dma.clk_reg;
+  volatile uint32_t *pwm = pwm_dma.pwm_reg;
+  pwm[PWM_CTL] = 0;
+  clk[CLK_PWMCTL] = CLK_PASSWD | (clk[CLK_PWMCTL] & ~CLK_CTL_ENAB);
+  while (clk[CLK_PWMCTL] & CLK_CTL_BUSY) usleep (10);
+  clk[CLK_PWMDIV] = CLK_PASSWD | ((plld_hz / PWM_CLOCK_HZ) << 12);
+  clk[CLK_PWMCTL] = CLK_PASSWD | CLK_CTL_SRC_PLLD | CLK_CTL_ENAB;
+  pwm[PWM_RNG1] = (PWM_CLOCK_HZ / 1000000) * PWM_DMA_STEP_USEC;
+  pwm[PWM_DMAC] = PWM_DMAC_ENAB | PWM_DMAC_PANIC (15) | PWM_DMAC_DREQ (15);
+  pwm[PWM_CTL] = PWM_CTL_CLRF1;
+  usleep (10);
+  pwm[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_PWEN1;
+
+  volatile uint32_t *dma = pwm_dma.dma_reg;
+  dma[DMA_CS] = DMA_CS_RESET;
+  usleep (10);
+  dma[DMA_CS] = DMA_CS_INT | DMA_CS_END;
+  dma[DMA_CONBLK_AD] = pwm_dma_bus (&pwm_dma.cbs[0]);
+  dma[DMA_DEBUG] = 7; // Clear any error flags
+  dma[DMA_CS] = DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIORITY (15) 
+    | DMA_CS_PRIORITY (15) | DMA_CS_ACTIVE;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_dma_mask_set
+
+  Set or clear a pin's bit in one mask word of the waveform.
+============================================================================*/
+static void pwm_dma_mask_set (volatile uint32_t *words, int pin, BOOL on)
+  {
+  volatile uint32_t *w = &words[pin >> 5];
+  uint32_t bit = 1u << (pin & 31);
+  if (on)
+    *w |= bit;
+  else
+    *w &= ~bit;
+  }
+
+/*============================================================================
+  pwm_dma_patch
+
+  Move the pin's edges to match on_usec. Called with the mutex held. The
+  new falling edge is added before the old one is removed, so the DMA
+  controller sees, at worst, one cycle with both -- a pulse that is 
+  shorter than either the old or new width -- rather than a cycle with
+  neither, which would leave the pin high for a whole cycle.
+
+============================================================================*/
+static void pwm_dma_patch (int pin, int on_usec)
+  {
+  int on_samples = on_usec / PWM_DMA_STEP_USEC;
+  BOOL rise = on_samples > 0;
+  int fall = on_samples < pwm_dma.samples ? on_samples : -1;
+  int old_fall = pwm_dma.fall[pin];
+
+  if (fall >= 0) 
+    pwm_dma_mask_set (pwm_dma.slots[fall].clr, pin, TRUE);
+  if (old_fall >= 0 && old_fall != fall)
+    pwm_dma_mask_set (pwm_dma.slots[old_fall].clr, pin, FALSE);
+  if (rise != pwm_dma.rise[pin])
+    pwm_dma_mask_set (pwm_dma.slots[0].set, pin, rise);
+  __sync_synchronize ();
+
+  pwm_dma.fall[pin] = fall;
+  pwm_dma.rise[pin] = rise;
+  }
+
+/*============================================================================
+  pwm_dma_start
+============================================================================*/
+BOOL pwm_dma_start (PWM *self, int cycle_usec, const PWMOptions *options,
+    char **error)
+  {
+  assert (self != NULL);
+  if (self->pin < 0 || self->pin > GPIOMEM_MAX_PIN)
+    {
+    pwm_set_error (error, options, "Can't set up pin: %s", strerror (EINVAL));
+    return FALSE;
+    }
+  BOOL ret = TRUE;
+  pthread_mutex_lock (&pwm_dma_mutex);
+  if (pwm_dma.users == 0)
+    ret = pwm_dma_init (cycle_usec, options, error);
+  else if (cycle_usec != pwm_dma.cycle_usec)
+    {
+    pwm_set_error (error, options, "DMA PWM pins must all have the same "
+      "cycle length (%d usec)", pwm_dma.cycle_usec);
+    ret = FALSE;
+    }
+  if (ret && pwm_dma.used[self->pin])
+    {
+    pwm_set_error (error, options, "Pin %d is already driven by DMA",
+      self->pin);
+    ret = FALSE;
+    }
+  if (ret)
+    {
+    pwm_dma.users++;
+    pwm_dma.used[self->pin] = TRUE;
+    self->running = TRUE;
+    self->cycle_usec = cycle_usec;
+    pwm_store_timing (self, 0, cycle_usec);
+    pwm_dma_patch (self->pin, 0);
+    gpiomem_write (self->pin, 0);
+    gpiomem_set_output (self->pin);
+    }
+  pthread_mutex_unlock (&pwm_dma_mutex);
+  return ret;
+  }
+
+/*============================================================================
+  pwm_dma_update
+============================================================================*/
+void pwm_dma_update (PWM *self)
+  {
+  assert (self != NULL);
+  int on_usec, off_usec;
+  pwm_load_timing (self, &on_usec, &off_usec);
+  pthread_mutex_lock (&pwm_dma_mutex);
+  // used[] only says that some instance drives the pin; this one may
+  //  never have been started, or been refused it
+  if (self->running)
+    pwm_dma_patch (self->pin, on_usec);
+  pthread_mutex_unlock (&pwm_dma_mutex);
+  }
+
+/*============================================================================
+  pwm_dma_stop
+============================================================================*/
+void pwm_dma_stop (PWM *self)
+  {
+  assert (self != NULL);
+  pthread_mutex_lock (&pwm_dma_mutex);
+  if (self->running)
+    {
+    // A pin with a falling edge but no rising edge is held low by the
+    //  waveform itself; then take it out altogether
+    pwm_dma_patch (self->pin, 0);
+    usleep (pwm_dma.cycle_usec);
+    if (pwm_dma.fall[self->pin] >= 0)
+      pwm_dma_mask_set (pwm_dma.slots[pwm_dma.fall[self->pin]].clr, 
+        self->pin, FALSE);
+    pwm_dma.fall[self->pin] = -1;
+    pwm_dma.used[self->pin] = FALSE;
+    self->running = FALSE;
+    gpiomem_write (self->pin, 0);
+    if (--pwm_dma.users == 0)
+      pwm_dma_release ();
+    }
+  pthread_mutex_unlock (&pwm_dma_mutex);
+  }
+
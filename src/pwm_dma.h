@@ -0,0 +1,44 @@
+/*============================================================================
+  
+  pwm_dma.h
+
+  DMA-driven PWM waveforms, for PWM instances created with
+  PWM_BACKEND_DMA. These functions are called from pwm.c, and are not
+  part of the public interface.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+// DMA channel used for the waveform. Channels 0-6 are full-featured;
+//  5 is not normally claimed by the firmware or the kernel
+#ifndef PWM_DMA_CHANNEL
+#define PWM_DMA_CHANNEL 5
+#endif
+
+// Time resolution of the waveform. Every on-time is rounded down to a
+//  multiple of this
+#ifndef PWM_DMA_STEP_USEC
+#define PWM_DMA_STEP_USEC 10
+#endif
+
+BEGIN_DECLS
+
+/** Add the pin to the DMA waveform, starting the DMA controller if this
+    is the first DMA pin. All DMA pins share one waveform, and so must 
+    have the same cycle length. On failure, reports the error with
+    pwm_set_error(). */
+BOOL     pwm_dma_start (PWM *pwm, int cycle_usec, const PWMOptions *options,
+           char **error);
+
+/** Patch the waveform with the pin's current on-time. */
+void     pwm_dma_update (PWM *pwm);
+
+/** Take the pin out of the waveform, leaving it low. When the last pin
+    goes, the DMA controller is stopped, and its memory freed. */
+void     pwm_dma_stop (PWM *pwm);
+
+END_DECLS
+
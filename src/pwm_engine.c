@@ -0,0 +1,873 @@
+/*==========================================================================
+  
+    pwm_engine.c
+
+    Multi-channel software PWM. Rather than each PWM instance running
+    its own timing thread, one thread keeps a table of the edges that
+    fall due in each cycle, for all the channels, sorted by time, with
+    the edges at the same time merged (see pwm_table.c). It sleeps until
+    the earliest one is due and then services every edge whose time has
+    come, before going back to sleep. So no matter how many channels 
+    there are, there is only one sleeping thread, and channels whose 
+    edges coincide cost one wakeup between them. With the gpiomem 
+    backend they also cost only one register write between them.
+
+    Having every channel start its pulse at the same moment is not always
+    what's wanted, though: with many servos it gives a burst of edges
+    and then a long idle period, and a high-power rig sees all its loads
+    switch on at once. So the engine can instead stagger the channels' 
+    phases evenly across the cycle, or use phases set per channel with 
+    pwm_set_phase().
+
+    Channels needn't share a cycle length, either: 50 Hz servos can run
+    alongside kHz LED or motor channels. The channels with each cycle 
+    length form a group, with its own table and timeline, and the thread
+    keeps the groups in a min-heap ordered by when each next needs it. 
+    This costs a heap step per wakeup, rather than a table that would 
+    have to cover the lowest common multiple of all the cycle lengths.
+
+    Channels that are fully on or fully off drop out of their group's 
+    table once their level is written, and a group with nothing left to
+    do parks, dropping to the bottom of the heap, until one of its duties
+    is set. With every group parked, the thread sleeps until then.
+
+    Typical calling sequence is:
+
+    PWMEngine *engine = pwm_engine_create (20000)
+    pwm_engine_add (engine, pwm1)
+    pwm_engine_add (engine, pwm2)
+    pwm_engine_start (engine, ...)
+    pmw_set_duty (pwm1, val1)
+    pmw_set_duty (pwm2, val2)
+    ...
+    pwm_engine_stop (engine)
+    pwm_engine_destroy (engine)
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_engine.h" 
+#include "pwm_internal.h" 
+#include "pwm_time.h" 
+#include "pwm_trace.h" 
+#include "pwm_thread.h" 
+#include "gpiomem.h" 
+#include "gpiochip.h" 
+#include "pwm_table.h" 
+#include "pwm_sysfs.h" 
+#include "pwm_hwpwm.h" 
+
+// The channels that share one cycle length. Each group runs its own 
+//  timeline, with its own tables, which it rebuilds and swaps at its 
+//  own cycle boundaries, so channels with unrelated cycle lengths need 
+//  only the edges of one cycle of each, not a table covering all of them
+typedef struct _PWMEngineGroup
+  {
+  int index; // In PWMEngine.groups, and bit in PWMEngine.dirty
+  int cycle_usec;
+  int num_channels; 
+  PWMTableChannel channels[PWM_ENGINE_MAX_CHANNELS];
+  // The timing thread walks one table while the other is free to be 
+  //  rebuilt, and swaps them at the cycle boundary
+  PWMTable tables[2];
+  PWMTable *active;
+  PWMTable *spare;
+  int64_t cycle_start; // When the current cycle started
+  int next_entry; // Next entry of the active table to service
+  // Time of the next entry, or of the end of the cycle, or 
+  //  PWM_TIME_FOREVER while the group is parked
+  int64_t due; 
+  BOOL ending; // Set when the cycle's edges are done, until it is prepared
+  BOOL rebuilt; // Set if the spare table is ready for the next cycle
+  } PWMEngineGroup;
+
+// Table entries from one group, serviced together with the other 
+//  groups' entries that are due at the same time
+typedef struct _PWMEngineRange
+  {
+  const PWMTable *table;
+  int first; 
+  int last;
+  int64_t cycle_start;
+  } PWMEngineRange;
+
+// The most ranges serviced at one wakeup: a group can finish one cycle 
+//  and start the next
+#define PWM_ENGINE_MAX_RANGES (2 * PWM_ENGINE_MAX_CHANNELS)
+
+struct _PWMEngine
+  {
+  int cycle_usec; // Cycle length of channels added by pwm_engine_add()
+  int num_channels; 
+  PWM *pwms[PWM_ENGINE_MAX_CHANNELS]; // In the order they were added
+  int num_groups;
+  PWMEngineGroup *groups[PWM_ENGINE_MAX_CHANNELS]; // One per cycle length
+  // The groups as a binary min-heap, keyed by due, so that the timing
+  //  thread always knows which group needs it next
+  PWMEngineGroup *heap[PWM_ENGINE_MAX_CHANNELS];
+  PWMPhaseMode phase_mode; 
+  PWMCycleHook hook; // Called by the timing thread each cycle, if set
+  void *hook_arg;
+  // Bit n is set when the duty of a channel in group n changes
+  atomic_uint_least64_t dirty; 
+  uint64_t parked; // Bit n is set while group n is parked
+  // Set while any group is parked, and the thread sleeps on it, so that 
+  //  a change to one of the parked groups wakes it (see pwm_time_park())
+  atomic_int wake;
+  pthread_t pthread; // Reference to the timing thread
+  BOOL running; // Set between pwm_engine_start() and pwm_engine_stop()
+  atomic_int stop; // Set by pwm_engine_stop(); the thread sleeps on it
+  int64_t spin_ns; // Busy-wait before each edge, or zero to just sleep
+  int min_pulse_usec; // Shorter pulses, or gaps, are dropped
+  // The levels the timing thread has left the mask-driven pins at, so 
+  //  that edges that wouldn't change anything can be dropped
+  uint64_t high[PWM_TABLE_MASKS];
+  atomic_ulong overruns; // Cycles that started too late to be serviced
+  GpioLines *lines; // One line request for all the chardev channels
+  PWMEngineRange ranges[PWM_ENGINE_MAX_RANGES]; // For the timing thread
+  };
+
+/*============================================================================
+  pwm_engine_create
+============================================================================*/
+PWMEngine *pwm_engine_create (int cycle_usec)
+  {
+  PWMEngine *self = malloc (sizeof (PWMEngine));
+  memset (self, 0, sizeof (PWMEngine));
+  self->cycle_usec = cycle_usec;
+  return self;
+  }
+
+/*============================================================================
+  pwm_engine_destroy
+============================================================================*/
+void pwm_engine_destroy (PWMEngine *self)
+  {
+  if (self)
+    {
+    pwm_engine_stop (self);
+    for (int i = 0; i < self->num_channels; i++)
+      self->pwms[i]->engine = NULL;
+    for (int g = 0; g < self->num_groups; g++)
+      free (self->groups[g]);
+    free (self);
+    }
+  }
+
+/*============================================================================
+  pwm_engine_get_group
+
+  Find the group for a cycle length, creating it if there isn't one.
+
+============================================================================*/
+static PWMEngineGroup *pwm_engine_get_group (PWMEngine *self, 
+    int cycle_usec)
+  {
+  for (int g = 0; g < self->num_groups; g++)
+    if (self->groups[g]->cycle_usec == cycle_usec) 
+      return self->groups[g];
+  PWMEngineGroup *group = malloc (sizeof (PWMEngineGroup));
+  memset (group, 0, sizeof (PWMEngineGroup));
+  group->index = self->num_groups;
+  group->cycle_usec = cycle_usec;
+  self->groups[self->num_groups++] = group;
+  return group;
+  }
+
+/*============================================================================
+  pwm_engine_add
+============================================================================*/
+BOOL pwm_engine_add (PWMEngine *self, PWM *pwm)
+  {
+  return pwm_engine_add_with_cycle (self, pwm, self->cycle_usec);
+  }
+
+/*============================================================================
+  pwm_engine_add_with_cycle
+============================================================================*/
+BOOL pwm_engine_add_with_cycle (PWMEngine *self, PWM *pwm, int cycle_usec)
+  {
+  assert (self != NULL);
+  assert (pwm != NULL);
+  assert (cycle_usec > 0);
+  if (self->running) return FALSE;
+  if (self->num_channels >= PWM_ENGINE_MAX_CHANNELS) return FALSE;
+  if (pwm->backend == PWM_BACKEND_DMA) return FALSE; // Not timed by a thread
+  PWMEngineGroup *group = pwm_engine_get_group (self, cycle_usec);
+  pwm->engine = self;
+  pwm->engine_group = group->index;
+  pwm->cycle_usec = cycle_usec;
+  pwm_store_timing (pwm, 0, cycle_usec);
+  self->pwms[self->num_channels++] = pwm;
+  group->channels[group->num_channels++].pwm = pwm;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_engine_set_cycle_hook
+============================================================================*/
+BOOL pwm_engine_set_cycle_hook (PWMEngine *self, PWMCycleHook hook, 
+    void *arg)
+  {
+  assert (self != NULL);
+  if (self->running) return FALSE;
+  self->hook = hook;
+  self->hook_arg = arg;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_engine_set_phase_mode
+============================================================================*/
+BOOL pwm_engine_set_phase_mode (PWMEngine *self, PWMPhaseMode mode)
+  {
+  assert (self != NULL);
+  if (self->running) return FALSE;
+  self->phase_mode = mode;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_engine_assign_phases
+
+  Work out each channel's phase. When staggering, the rising edges of 
+  each group are spaced evenly across its cycle, in the order the 
+  channels were added.
+
+============================================================================*/
+static void pwm_engine_assign_phases (PWMEngine *self)
+  {
+  for (int g = 0; g < self->num_groups; g++)
+    {
+    PWMEngineGroup *group = self->groups[g];
+    int n = group->num_channels;
+    for (int i = 0; i < n; i++)
+      {
+      int phase;
+      if (self->phase_mode == PWM_PHASE_STAGGER)
+        phase = (int)((int64_t)group->cycle_usec * i / n);
+      else
+        phase = group->channels[i].pwm->phase_usec % group->cycle_usec;
+      group->channels[i].phase_usec = phase;
+      group->channels[i].carry_usec = -1;
+      group->channels[i].level = -1;
+      }
+    }
+  }
+
+/*============================================================================
+  pwm_engine_mark_dirty
+============================================================================*/
+static inline void pwm_engine_mark_dirty (PWMEngine *self, int group)
+  {
+  atomic_fetch_or_explicit (&self->dirty, (uint64_t)1 << group, 
+    memory_order_release);
+  }
+
+/*============================================================================
+  pwm_engine_changed
+============================================================================*/
+void pwm_engine_changed (PWM *pwm)
+  {
+  pwm_engine_mark_dirty (pwm->engine, pwm->engine_group);
+  pwm_time_unpark (&pwm->engine->wake);
+  }
+
+/*============================================================================
+  pwm_engine_count_overruns
+
+  Called when at least one of the entry's edges was written too late: 
+  find out which, and count them against their channels.
+
+============================================================================*/
+static void pwm_engine_count_overruns (const PWMTable *table, 
+    const PWMTableEntry *entry, int now_usec)
+  {
+  const PWMTableEdge *e = &table->edges[entry->first_edge];
+  for (int i = 0; i < entry->num_edges; i++, e++)
+    if (now_usec > e->deadline_usec)
+      atomic_fetch_add_explicit (&e->pwm->overruns, 1, memory_order_relaxed);
+  }
+
+/*============================================================================
+  pwm_engine_service
+
+  Write the table entries in the ranges, which are all due now. Usually
+  there is just one entry, but if the thread woke late, or edges from 
+  groups with different cycle lengths fall together, there may be more.
+  The entries' masks are combined, with later edges overriding earlier 
+  ones on the same pin, and written with one store to GPSETn and one to
+  GPCLRn for the gpiomem pins, and one ioctl for the chardev pins. So
+  however many pins change together, they really do change at the same
+  instant. Sysfs and simulated pins are written one after another, with
+  no delay between them. Edges that would leave a pin at the level it 
+  already has are dropped.
+
+  Afterwards, every edge in the entries is timed against its schedule for
+  its channel's statistics.
+
+============================================================================*/
+static void pwm_engine_service (PWMEngine *self, const PWMEngineRange *ranges,
+    int num_ranges, int64_t now)
+  {
+  uint64_t set[PWM_TABLE_MASKS] = { 0 }, clr[PWM_TABLE_MASKS] = { 0 };
+  BOOL has_unmasked = FALSE;
+  for (int r = 0; r < num_ranges; r++)
+    {
+    const PWMEngineRange *range = &ranges[r];
+    int now_usec = (int)((now - range->cycle_start) / PWM_NSEC_PER_USEC);
+    for (int i = range->first; i < range->last; i++)
+      {
+      const PWMTableEntry *entry = &range->table->entries[i];
+      for (int b = 0; b < PWM_TABLE_MASKS; b++)
+        {
+        set[b] = (set[b] & ~entry->clr[b]) | entry->set[b];
+        clr[b] = (clr[b] & ~entry->set[b]) | entry->clr[b];
+        }
+      has_unmasked |= entry->has_unmasked;
+      if (now_usec > entry->deadline_usec)
+        pwm_engine_count_overruns (range->table, entry, now_usec);
+      }
+    }
+  // Drop the edges that wouldn't change anything
+  for (int b = 0; b < PWM_TABLE_MASKS; b++)
+    {
+    set[b] &= ~self->high[b];
+    clr[b] &= self->high[b];
+    self->high[b] = (self->high[b] | set[b]) & ~clr[b];
+    }
+  if (set[PWM_TABLE_GPIOMEM] | clr[PWM_TABLE_GPIOMEM])
+    gpiomem_write_masks (set[PWM_TABLE_GPIOMEM], clr[PWM_TABLE_GPIOMEM]);
+  if (set[PWM_TABLE_CHARDEV] | clr[PWM_TABLE_CHARDEV])
+    gpiochip_write_masks (self->lines, set[PWM_TABLE_CHARDEV], 
+      clr[PWM_TABLE_CHARDEV]);
+  if (has_unmasked)
+    {
+    for (int r = 0; r < num_ranges; r++)
+      {
+      const PWMTable *table = ranges[r].table;
+      const PWMTableEntry *last = &table->entries[ranges[r].last - 1];
+      int end = last->first_edge + last->num_edges;
+      for (int i = table->entries[ranges[r].first].first_edge; i < end; i++)
+        {
+        const PWMTableEdge *e = &table->edges[i];
+        if (e->pwm->backend == PWM_BACKEND_SYSFS 
+            || e->pwm->backend == PWM_BACKEND_SIM)
+          pwm_write_level (e->pwm, e->level);
+        }
+      }
+    }
+  // One clock read covers every edge written together
+  int64_t written = pwm_time_now ();
+  for (int r = 0; r < num_ranges; r++)
+    {
+    const PWMEngineRange *range = &ranges[r];
+    for (int i = range->first; i < range->last; i++)
+      {
+      const PWMTableEntry *entry = &range->table->entries[i];
+      int64_t due = range->cycle_start 
+        + entry->offset_usec * PWM_NSEC_PER_USEC;
+      const PWMTableEdge *e = &range->table->edges[entry->first_edge];
+      for (int j = 0; j < entry->num_edges; j++, e++)
+        {
+        pwm_stats_edge (&e->pwm->stats, due, written);
+        PWM_TRACE_EDGE (e->pwm->pin, e->level, due, written);
+        }
+      }
+    }
+  }
+
+/*============================================================================
+  pwm_engine_build
+
+  Build a table for the group's next cycle, if any of its duties has 
+  changed. Returns TRUE if it did. The group's dirty bit is cleared 
+  before the duties are read, so an update that arrives while we're 
+  building isn't lost -- it just causes another rebuild next cycle.
+
+============================================================================*/
+static BOOL pwm_engine_build (PWMEngine *self, PWMEngineGroup *group, 
+    PWMTable *table)
+  {
+  uint64_t bit = (uint64_t)1 << group->index;
+  if (!(atomic_fetch_and_explicit (&self->dirty, ~bit, memory_order_acq_rel) 
+      & bit))
+    return FALSE;
+  // If a pulse's falling edge moves from one cycle to the next, the 
+  //  following cycle's table differs from this one, too
+  if (pwm_table_build (table, group->channels, group->num_channels, 
+      group->cycle_usec, self->min_pulse_usec))
+    pwm_engine_mark_dirty (self, group->index);
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_engine_prepare
+
+  The group's edges for this cycle are all done: give the cycle hook, if
+  there is one, the chance to set new duties, step the channels that are
+  ramping their on-time (see pwm_move_pulse_usec()) or dithering it (see
+  pwm_set_dither()), or going idle (see pwm_set_idle_timeout()), and 
+  build the next cycle's table, if anything has changed.
+
+============================================================================*/
+static void pwm_engine_prepare (PWMEngine *self, PWMEngineGroup *group)
+  {
+  if (self->hook) self->hook (self->hook_arg);
+  for (int c = 0; c < group->num_channels; c++)
+    {
+    PWM *pwm = group->channels[c].pwm;
+    pwm_stats_bump (&pwm->stats.cycles);
+    if (pwm_idle_step (pwm, group->cycle_start))
+      pwm_engine_mark_dirty (self, group->index);
+    if (pwm_motion_step (pwm))
+      {
+      // The tables leave out hardware PWM channels, so the ramp's
+      //  steps go straight to the peripheral
+      if (pwm->backend == PWM_BACKEND_HWPWM)
+        pwm_hwpwm_update (pwm);
+      else
+        pwm_engine_mark_dirty (self, group->index);
+      }
+    if (pwm_dither_step (pwm))
+      pwm_engine_mark_dirty (self, group->index);
+    }
+  group->rebuilt = pwm_engine_build (self, group, group->spare);
+  group->ending = FALSE;
+  }
+
+/*============================================================================
+  pwm_engine_schedule
+
+  Work out when the group next needs the timing thread: for its next 
+  entry or, if it has serviced them all, for the end of its cycle.
+
+============================================================================*/
+static void pwm_engine_schedule (PWMEngineGroup *group)
+  {
+  if (group->next_entry < group->active->num_entries)
+    group->due = group->cycle_start 
+      + group->active->entries[group->next_entry].offset_usec 
+        * PWM_NSEC_PER_USEC;
+  else
+    group->due = group->cycle_start + group->cycle_usec * PWM_NSEC_PER_USEC;
+  }
+
+/*============================================================================
+  pwm_engine_sift_down
+
+  Restore the heap ordering after the due time of the group at heap 
+  index i has moved later. This is the only way it changes, except when
+  a group is unparked, after which the heap is rebuilt.
+
+============================================================================*/
+static void pwm_engine_sift_down (PWMEngine *self, int i)
+  {
+  PWMEngineGroup **heap = self->heap;
+  int n = self->num_groups;
+  for (;;)
+    {
+    int child = 2 * i + 1;
+    if (child >= n) break;
+    if (child + 1 < n && heap[child + 1]->due < heap[child]->due) child++;
+    if (heap[i]->due <= heap[child]->due) break;
+    PWMEngineGroup *t = heap[i];
+    heap[i] = heap[child];
+    heap[child] = t;
+    i = child;
+    }
+  }
+
+/*============================================================================
+  pwm_engine_advance
+
+  Do whatever the group at the top of the heap is due for, at time now,
+  adding any entries that need servicing to the ranges: either the 
+  entries whose time has come, or the start of a new cycle.
+
+============================================================================*/
+static void pwm_engine_advance (PWMEngine *self, PWMEngineGroup *group, 
+    int64_t now, int *num_ranges)
+  {
+  PWMTable *table = group->active;
+  int n = table->num_entries;
+  if (group->next_entry < n)
+    {
+    int now_usec = (int)((now - group->cycle_start) / PWM_NSEC_PER_USEC);
+    int i = group->next_entry;
+    do i++; while (i < n && table->entries[i].offset_usec <= now_usec);
+    PWMEngineRange *range = &self->ranges[(*num_ranges)++];
+    range->table = table;
+    range->first = group->next_entry;
+    range->last = i;
+    range->cycle_start = group->cycle_start;
+    group->next_entry = i;
+    // The next cycle is prepared once these edges are written
+    if (i == n) group->ending = TRUE;
+    }
+  else
+    {
+    // The thread was too late to prepare the cycle before it ended
+    if (group->ending) pwm_engine_prepare (self, group);
+    if (group->rebuilt)
+      {
+      PWMTable *t = group->active;
+      group->active = group->spare;
+      group->spare = t;
+      group->rebuilt = FALSE;
+      }
+    int64_t cycle_ns = group->cycle_usec * PWM_NSEC_PER_USEC;
+    group->cycle_start += cycle_ns;
+    if (pwm_time_resync (&group->cycle_start, cycle_ns, now) > 0)
+      atomic_fetch_add_explicit (&self->overruns, 1, memory_order_relaxed);
+    group->next_entry = 0;
+    if (group->active->num_entries == 0) group->ending = TRUE;
+    }
+  pwm_engine_schedule (group);
+  pwm_engine_sift_down (self, 0);
+  }
+
+/*============================================================================
+  pwm_engine_heapify
+
+  Rebuild the heap from scratch. Inserting the groups in due order makes
+  a valid heap, and there are only ever a few of them.
+
+============================================================================*/
+static void pwm_engine_heapify (PWMEngine *self)
+  {
+  for (int g = 0; g < self->num_groups; g++)
+    {
+    PWMEngineGroup *group = self->groups[g];
+    int i = g;
+    while (i > 0 && self->heap[i - 1]->due > group->due)
+      {
+      self->heap[i] = self->heap[i - 1];
+      i--;
+      }
+    self->heap[i] = group;
+    }
+  }
+
+/*============================================================================
+  pwm_engine_can_park
+
+  Whether the group, whose next cycle has just been prepared, has 
+  nothing to do until one of its duties is set: it has no edges, its 
+  table isn't about to change, and no channel is ramping or dithering. 
+  With a cycle hook, which might set a duty at any cycle boundary, a 
+  group never parks.
+
+============================================================================*/
+static BOOL pwm_engine_can_park (const PWMEngine *self, 
+    const PWMEngineGroup *group)
+  {
+  if (self->hook || group->rebuilt || group->active->num_entries > 0)
+    return FALSE;
+  for (int c = 0; c < group->num_channels; c++)
+    if (!pwm_steady (group->channels[c].pwm)) return FALSE;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_engine_park
+============================================================================*/
+static void pwm_engine_park (PWMEngine *self, PWMEngineGroup *group)
+  {
+  int i = 0;
+  while (self->heap[i] != group) i++;
+  group->due = PWM_TIME_FOREVER;
+  pwm_engine_sift_down (self, i);
+  self->parked |= (uint64_t)1 << group->index;
+  }
+
+/*============================================================================
+  pwm_engine_unpark
+
+  Bring back the parked groups whose duties have been set, before the
+  thread goes to sleep. wake is set before the dirty bits are read, so
+  that a duty set after this will wake the thread. A group that comes 
+  back has its next cycle prepared straight away, and starts it at the
+  next boundary of its old timeline, so its channels keep their phases.
+
+============================================================================*/
+static void pwm_engine_unpark (PWMEngine *self)
+  {
+  atomic_store (&self->wake, TRUE);
+  uint64_t back = atomic_load (&self->dirty) & self->parked;
+  if (!back) return;
+  int64_t now = pwm_time_now ();
+  for (int g = 0; g < self->num_groups; g++)
+    {
+    PWMEngineGroup *group = self->groups[g];
+    if (!(back & ((uint64_t)1 << g))) continue;
+    pwm_time_resync (&group->cycle_start, 
+      group->cycle_usec * PWM_NSEC_PER_USEC, now);
+    group->next_entry = group->active->num_entries;
+    group->ending = TRUE;
+    pwm_engine_schedule (group);
+    }
+  self->parked &= ~back;
+  if (!self->parked) atomic_store (&self->wake, FALSE);
+  pwm_engine_heapify (self);
+  }
+
+/*============================================================================
+  pwm_engine_loop
+
+  The timing thread. Each group of channels with the same cycle length
+  walks its active table, with entry times measured from the start of 
+  its cycle, so time spent writing pins doesn't accumulate. The thread 
+  sleeps until the earliest thing that any group is due for, whether an
+  entry or the end of a cycle, does everything that all the groups are 
+  due for by the time it wakes, writing their edges together, and goes
+  back to sleep. With one group, that's just a walk along its table.
+
+  Once a group's last edge in a cycle is written, its next cycle is 
+  prepared (see pwm_engine_prepare()). A group's table only changes when
+  one of its duties does, and then the new table is built in the spare 
+  buffer, and takes over at the cycle boundary. So the work per cycle 
+  doesn't depend on how many channels there are, or how they are 
+  configured, only on the number of distinct edge times, and channels of
+  one cycle length cost nothing at the edges and cycle boundaries of 
+  another.
+
+  If a group is held up for longer than a whole cycle, the cycles it 
+  missed are dropped, and its timeline picks up at the correct phase.
+
+  A group that has nothing to do parks once its next cycle is prepared,
+  and while any group is parked, the thread sleeps on wake, as well as
+  until its next deadline, so that a change to a parked group's duty 
+  wakes it to bring the group back.
+
+============================================================================*/
+static void *pwm_engine_loop (void *arg)
+  {
+  PWMEngine *self = (PWMEngine *)arg;
+  int64_t start = pwm_time_now ();
+  for (int i = 0; i < self->num_channels; i++)
+    self->pwms[i]->idle_since = start;
+  for (int g = 0; g < self->num_groups; g++)
+    {
+    PWMEngineGroup *group = self->groups[g];
+    group->active = &group->tables[0];
+    group->spare = &group->tables[1];
+    pwm_engine_mark_dirty (self, g);
+    pwm_engine_build (self, group, group->active);
+    group->cycle_start = start;
+    group->next_entry = 0;
+    group->ending = group->active->num_entries == 0;
+    group->rebuilt = FALSE;
+    pwm_engine_schedule (group);
+    }
+  pwm_engine_heapify (self);
+  self->parked = 0;
+  atomic_store (&self->wake, FALSE);
+  while (!self->stop)
+    {
+    if (self->parked) pwm_engine_unpark (self);
+    int64_t due = self->heap[0]->due;
+    PWM_TRACE_WAIT (-1, due);
+    if (self->parked)
+      pwm_time_park (&self->wake, due, self->spin_ns, &self->stop);
+    else
+      pwm_time_sleep_until (due, self->spin_ns, &self->stop);
+    if (self->stop) break;
+    int64_t now = pwm_time_now ();
+    PWM_TRACE_WAKE (-1, due, now);
+    int num_ranges = 0;
+    while (self->heap[0]->due <= now && num_ranges < PWM_ENGINE_MAX_RANGES)
+      pwm_engine_advance (self, self->heap[0], now, &num_ranges);
+    if (num_ranges > 0)
+      pwm_engine_service (self, self->ranges, num_ranges, now);
+    for (int g = 0; g < self->num_groups; g++)
+      {
+      PWMEngineGroup *group = self->groups[g];
+      if (!group->ending) continue;
+      pwm_engine_prepare (self, group);
+      if (pwm_engine_can_park (self, group)) pwm_engine_park (self, group);
+      }
+    }
+  return NULL;
+  }
+
+/*============================================================================
+  pwm_engine_request_lines
+
+  Make one line request for all the channels that use the character 
+  device, and share it between them. Returns 0, or -1 with errno set.
+
+============================================================================*/
+static int pwm_engine_request_lines (PWMEngine *self)
+  {
+  int pins[PWM_ENGINE_MAX_CHANNELS];
+  int n = 0;
+  for (int i = 0; i < self->num_channels; i++)
+    pwm_resolve_backend (self->pwms[i]);
+  for (int i = 0; i < self->num_channels; i++)
+    if (self->pwms[i]->backend == PWM_BACKEND_CHARDEV)
+      pins[n++] = self->pwms[i]->pin;
+  if (n == 0) return 0;
+  self->lines = gpiochip_request (pins, n);
+  if (!self->lines) return -1;
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    PWM *pwm = self->pwms[i];
+    if (pwm->backend == PWM_BACKEND_CHARDEV)
+      {
+      pwm->lines = self->lines;
+      pwm->own_lines = FALSE;
+      }
+    }
+  return 0;
+  }
+
+/*============================================================================
+  pwm_engine_release_lines
+============================================================================*/
+static void pwm_engine_release_lines (PWMEngine *self)
+  {
+  // Whether or not they were set up, none of the channels may keep the
+  //  request, which a later pwm_start() on its own would write through
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    PWM *pwm = self->pwms[i];
+    if (self->lines && pwm->lines == self->lines)
+      {
+      pwm->lines = NULL;
+      pwm->own_lines = FALSE;
+      }
+    }
+  gpiochip_release (self->lines);
+  self->lines = NULL;
+  }
+
+/*============================================================================
+  pwm_engine_setup_sysfs
+
+  Set up all the sysfs channels together, which is much faster than one 
+  at a time (see pwm_sysfs.c). Returns 0, or -1 with errno set.
+
+============================================================================*/
+static int pwm_engine_setup_sysfs (PWMEngine *self)
+  {
+  PWM *pwms[PWM_ENGINE_MAX_CHANNELS];
+  int n = 0;
+  for (int i = 0; i < self->num_channels; i++)
+    if (self->pwms[i]->backend == PWM_BACKEND_SYSFS)
+      pwms[n++] = self->pwms[i];
+  if (n == 0) return 0;
+  return pwm_sysfs_setup (pwms, n);
+  }
+
+/*============================================================================
+  pwm_engine_start
+============================================================================*/
+BOOL pwm_engine_start (PWMEngine *self, char **error)
+  {
+  return pwm_engine_start_with_options (self, NULL, error);
+  }
+
+/*============================================================================
+  pwm_engine_start_with_options
+============================================================================*/
+BOOL pwm_engine_start_with_options (PWMEngine *self, 
+    const PWMOptions *options, char **error)
+  {
+  assert (self != NULL);
+  if (self->running) return TRUE;
+  self->spin_ns = pwm_options_spin_ns (options);
+  self->min_pulse_usec = options ? options->min_pulse_usec : 0;
+  // Every pin is set up low
+  memset (self->high, 0, sizeof (self->high));
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    self->pwms[i]->level = -1;
+    self->pwms[i]->idle = FALSE;
+    }
+  // With no channels, the thread still runs the engine's own cycle
+  if (self->num_groups == 0)
+    pwm_engine_get_group (self, self->cycle_usec);
+  pwm_engine_assign_phases (self);
+  if (pwm_engine_request_lines (self) != 0)
+    {
+    pwm_set_error (error, options, "Can't request GPIO lines from %s: %s",
+      GPIOCHIP_DEVICE, strerror (errno));
+    return FALSE;
+    }
+  if (pwm_engine_setup_sysfs (self) != 0)
+    {
+    pwm_set_error (error, options, "Can't set up sysfs GPIO pins: %s",
+      strerror (errno));
+    pwm_engine_release_lines (self);
+    return FALSE;
+    }
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    if (pwm_setup_pin (self->pwms[i]) != 0)
+      {
+      int saved_errno = errno;
+      pwm_set_error (error, options, "Can't set up pin %d: %s",
+        self->pwms[i]->pin, strerror (saved_errno));
+      // The sysfs pins were all set up already
+      for (int j = 0; j < self->num_channels; j++)
+        if (j < i || self->pwms[j]->backend == PWM_BACKEND_SYSFS)
+          pwm_unsetup_pin (self->pwms[j]);
+      pwm_engine_release_lines (self);
+      return FALSE;
+      }
+    // Setting up a hardware PWM channel zeroes its duty
+    if (self->pwms[i]->backend == PWM_BACKEND_HWPWM)
+      pwm_hwpwm_update (self->pwms[i]);
+    }
+  atomic_store (&self->stop, FALSE);
+  if (!pwm_thread_start (&self->pthread, pwm_engine_loop, self, options, 
+      error))
+    {
+    for (int i = 0; i < self->num_channels; i++)
+      pwm_unsetup_pin (self->pwms[i]);
+    pwm_engine_release_lines (self);
+    return FALSE;
+    }
+  self->running = TRUE;
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_engine_get_overruns
+============================================================================*/
+unsigned long pwm_engine_get_overruns (const PWMEngine *self)
+  {
+  assert (self != NULL);
+  return atomic_load_explicit (&self->overruns, memory_order_relaxed);
+  }
+
+/*============================================================================
+  pwm_engine_stop
+============================================================================*/
+void pwm_engine_stop (PWMEngine *self)
+  {
+  assert (self != NULL);
+  if (!self->running) return;
+  pwm_time_interrupt (&self->stop);
+  pwm_time_unpark (&self->wake);
+  pthread_join (self->pthread, NULL);
+  self->running = FALSE;
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    pwm_set_pin (self->pwms[i], 0);
+    pwm_unsetup_pin (self->pwms[i]);
+    }
+  pwm_engine_release_lines (self);
+  }
+
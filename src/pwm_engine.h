@@ -0,0 +1,100 @@
+/*============================================================================
+  
+  pwm_engine.h
+
+  A multi-channel PWM engine: one timing thread drives any number of
+  PWM instances, in place of one thread per instance.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+struct _PWMEngine;
+typedef struct _PWMEngine PWMEngine;
+
+// The most PWM instances that one engine can drive
+#define PWM_ENGINE_MAX_CHANNELS 64
+
+// How an engine places each channel's pulse within the cycle
+typedef enum
+  {
+  // Each channel's pulse starts at the phase set with pwm_set_phase() --
+  //  by default at the start of the cycle, so that all the rising edges 
+  //  coincide and, with gpiomem, cost one register write
+  PWM_PHASE_MANUAL = 0,
+  // Rising edges are spread evenly across the cycle, ignoring the phases
+  //  of the individual channels
+  PWM_PHASE_STAGGER
+  } PWMPhaseMode;
+
+// A function that the timing thread calls at every cycle boundary, 
+//  before the next cycle's table is built, so that it can set duties 
+//  that take effect in that cycle. Where channels have different cycle
+//  lengths, it is called at the end of a cycle of any of them. It must 
+//  not block
+typedef void (*PWMCycleHook) (void *arg);
+
+BEGIN_DECLS
+
+/** Create an engine. Channels added with pwm_engine_add() have the
+    given cycle length, in microseconds; others can have their own. Call
+    pwm_engine_destroy() when finished. */
+PWMEngine *pwm_engine_create (int cycle_usec);
+
+/** Stop the engine, if it is running, and free it. The PWM instances
+    that were added are not destroyed -- the caller still owns them,
+    and should destroy them after the engine. */
+void       pwm_engine_destroy (PWMEngine *self);
+
+/** Hand a PWM instance to the engine. This must be done before 
+    pwm_engine_start(), and the instance must not be started on its own.
+    pwm_set_duty() works exactly as it does for a stand-alone instance.
+    Returns FALSE if the engine is running, or already has
+    PWM_ENGINE_MAX_CHANNELS channels, or if the instance uses the DMA 
+    backend, which does its own timing. A hardware PWM channel may be 
+    added; the engine sets it up, and passes on its duty and its ramps,
+    but the peripheral times it. */
+BOOL       pwm_engine_add (PWMEngine *self, PWM *pwm);
+
+/** As pwm_engine_add(), but the channel has its own cycle length, in
+    microseconds, which need have nothing to do with the engine's or 
+    the other channels'. Channels with the same cycle length keep their
+    edges in one table, so it's cheapest to use only a few. */
+BOOL       pwm_engine_add_with_cycle (PWMEngine *self, PWM *pwm, 
+             int cycle_usec);
+
+/** Select how the channels' phases are set. Staggered phases are spread
+    across the cycle of each cycle length separately. This must be done before
+    pwm_engine_start(); returns FALSE if the engine is running. */
+BOOL       pwm_engine_set_phase_mode (PWMEngine *self, PWMPhaseMode mode);
+
+/** Have the timing thread call hook(arg) at every cycle boundary, or 
+    stop calling it if hook is NULL. There is one hook per engine. This 
+    must be done before pwm_engine_start(); returns FALSE if the engine 
+    is running. */
+BOOL       pwm_engine_set_cycle_hook (PWMEngine *self, PWMCycleHook hook,
+             void *arg);
+
+/** Set up the GPIO for all channels, and start the timing thread. If
+    any pin can't be set up, none are left set up, and *error is filled
+    in. Caller must free *error if it is set. */
+BOOL       pwm_engine_start (PWMEngine *self, char **error);
+
+/** As pwm_engine_start(), but with options, which apply to the timing
+    thread and so to all channels. options may be NULL. */
+BOOL       pwm_engine_start_with_options (PWMEngine *self, 
+             const PWMOptions *options, char **error);
+
+/** Stop the timing thread, and uninitialize the GPIO for all channels,
+    leaving the outputs low. */
+void       pwm_engine_stop (PWMEngine *self);
+
+/** The number of times the timing thread was held up by more than a whole
+    cycle, so that at least one cycle was dropped. Edges missed by 
+    individual channels are counted by pwm_get_overruns(). */
+unsigned long pwm_engine_get_overruns (const PWMEngine *self);
+
+END_DECLS
+
@@ -0,0 +1,193 @@
+/*==========================================================================
+  
+    pwm_hwpwm.c
+
+    Hardware PWM, through the kernel's /sys/class/pwm interface. GPIO 12 
+    and 18 can be routed to channel 0 of the PWM peripheral, and GPIO 13 
+    and 19 to channel 1. On those pins the peripheral generates the
+    waveform itself, with no jitter and no CPU usage, and setting the 
+    duty is one write to the channel's duty_cycle file. 
+
+    The pins have to be routed to the peripheral by the device tree, e.g.
+
+    dtoverlay=pwm-2chan,pin=18,func=2,pin2=19,func2=2
+
+    in config.txt. Both channels share one clock, so in practice the two 
+    channels can have different periods, but not arbitrary ones.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_internal.h" 
+#include "pwm_hwpwm.h" 
+#include "gpiomem.h" 
+
+// The PWM driving each channel. GPIO 12 and 18 share channel 0, and 13
+//  and 19 channel 1, so two PWMs could otherwise both write one 
+//  duty_cycle, and either could disable it under the other
+static PWM *pwm_hwpwm_owner[2];
+static pthread_mutex_t pwm_hwpwm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*============================================================================
+  pwm_hwpwm_channel
+============================================================================*/
+int pwm_hwpwm_channel (int pin)
+  {
+  switch (pin)
+    {
+    case 12: case 18: return 0;
+    case 13: case 19: return 1;
+    }
+  return -1;
+  }
+
+/*============================================================================
+  pwm_hwpwm_available
+============================================================================*/
+BOOL pwm_hwpwm_available (int pin)
+  {
+  if (pwm_hwpwm_channel (pin) < 0) return FALSE;
+  if (access (PWM_HWPWM_CHIP "/export", W_OK) != 0) return FALSE;
+  // GPIO 12 and 18 share channel 0, and 13 and 19 channel 1, so the 
+  //  chip being there doesn't mean that this pin is the one routed to it
+  if (gpiomem_open () != 0) return FALSE;
+  int function = gpiomem_get_function (pin);
+  return function == (pin < 18 ? GPIOMEM_FUNC_ALT0 : GPIOMEM_FUNC_ALT5);
+  }
+
+/*============================================================================
+  pwm_hwpwm_write_attr
+
+  Write a number to one of the channel's attribute files.
+============================================================================*/
+static int pwm_hwpwm_write_attr (int channel, const char *attr, long value)
+  {
+  char path[80];
+  char s[32];
+  snprintf (path, sizeof (path), PWM_HWPWM_CHIP "/pwm%d/%s", channel, attr);
+  snprintf (s, sizeof (s), "%ld", value);
+  return pwm_write_to_file (path, s);
+  }
+
+/*============================================================================
+  pwm_hwpwm_release
+
+  Give up ownership of the channel.
+============================================================================*/
+static void pwm_hwpwm_release (int channel)
+  {
+  pthread_mutex_lock (&pwm_hwpwm_mutex);
+  pwm_hwpwm_owner[channel] = NULL;
+  pthread_mutex_unlock (&pwm_hwpwm_mutex);
+  }
+
+/*============================================================================
+  pwm_hwpwm_setup
+============================================================================*/
+int pwm_hwpwm_setup (PWM *self)
+  {
+  assert (self != NULL);
+  int channel = pwm_hwpwm_channel (self->pin);
+  if (channel < 0) 
+    {
+    errno = EINVAL;
+    return -1;
+    }
+
+  pthread_mutex_lock (&pwm_hwpwm_mutex);
+  BOOL taken = pwm_hwpwm_owner[channel] != NULL;
+  if (!taken) pwm_hwpwm_owner[channel] = self;
+  pthread_mutex_unlock (&pwm_hwpwm_mutex);
+  if (taken)
+    {
+    errno = EBUSY;
+    return -1;
+    }
+
+  char s[80];
+  snprintf (s, sizeof (s), PWM_HWPWM_CHIP "/pwm%d", channel);
+  BOOL exported = FALSE;
+  if (access (s, F_OK) != 0)
+    {
+    snprintf (s, sizeof (s), "%d", channel);
+    if (pwm_write_to_file (PWM_HWPWM_CHIP "/export", s) != 0) 
+      {
+      int saved_errno = errno;
+      pwm_hwpwm_release (channel);
+      errno = saved_errno;
+      return -1;
+      }
+    exported = TRUE;
+    }
+
+  // The duty cycle may never exceed the period, so zero it before
+  //  changing the period
+  pwm_hwpwm_write_attr (channel, "duty_cycle", 0);
+  if (pwm_hwpwm_write_attr (channel, "period", 
+        self->cycle_usec * 1000L) == 0
+      && pwm_hwpwm_write_attr (channel, "enable", 1) == 0)
+    {
+    snprintf (s, sizeof (s), PWM_HWPWM_CHIP "/pwm%d/duty_cycle", channel);
+    self->f_value = open (s, O_WRONLY | O_CLOEXEC);
+    if (self->f_value >= 0) return 0;
+    }
+
+  // Leave the channel as we found it, with the error we failed on
+  int saved_errno = errno;
+  pwm_hwpwm_write_attr (channel, "enable", 0);
+  if (exported)
+    {
+    snprintf (s, sizeof (s), "%d", channel);
+    pwm_write_to_file (PWM_HWPWM_CHIP "/unexport", s);
+    }
+  pwm_hwpwm_release (channel);
+  errno = saved_errno;
+  return -1;
+  }
+
+/*============================================================================
+  pwm_hwpwm_update
+============================================================================*/
+void pwm_hwpwm_update (PWM *self)
+  {
+  assert (self != NULL);
+  if (self->f_value < 0) return;
+  int on_usec, off_usec;
+  pwm_load_timing (self, &on_usec, &off_usec);
+  char s[32];
+  int len = snprintf (s, sizeof (s), "%ld", on_usec * 1000L);
+  pwrite (self->f_value, s, len, 0);
+  }
+
+/*============================================================================
+  pwm_hwpwm_unsetup
+============================================================================*/
+int pwm_hwpwm_unsetup (PWM *self)
+  {
+  assert (self != NULL);
+  int channel = pwm_hwpwm_channel (self->pin);
+  // Only the owner has the duty_cycle file open
+  if (channel < 0 || self->f_value < 0) return 0;
+  close (self->f_value);
+  self->f_value = -1;
+  // With the channel disabled, the pin idles low
+  pwm_hwpwm_write_attr (channel, "duty_cycle", 0);
+  pwm_hwpwm_write_attr (channel, "enable", 0);
+  char s[32];
+  snprintf (s, sizeof (s), "%d", channel);
+  int ret = pwm_write_to_file (PWM_HWPWM_CHIP "/unexport", s);
+  pwm_hwpwm_release (channel);
+  return ret;
+  }
+
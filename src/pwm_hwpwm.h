@@ -0,0 +1,43 @@
+/*============================================================================
+  
+  pwm_hwpwm.h
+
+  Hardware PWM passthrough, for PWM instances on pins that can be routed
+  to the BCM283x PWM peripheral. These functions are called from pwm.c,
+  and are not part of the public interface.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+// The kernel's PWM chip for the BCM283x PWM peripheral
+#define PWM_HWPWM_CHIP "/sys/class/pwm/pwmchip0"
+
+BEGIN_DECLS
+
+/** The PWM peripheral channel (0 or 1) that the pin can be routed to, or
+    -1 if it is not one of the PWM-capable pins. */
+int      pwm_hwpwm_channel (int pin);
+
+/** TRUE if the pin is PWM-capable, the kernel has a PWM chip to drive
+    it, and the pin is routed to the PWM peripheral -- by the 'pwm' or
+    'pwm-2chan' overlay, which sets its function to ALT0 on GPIO 12 and
+    13, or ALT5 on 18 and 19. Otherwise the channel's output, if it has
+    one, is on the pin's partner. */
+BOOL     pwm_hwpwm_available (int pin);
+
+/** Export the channel, and set its period from the PWM's cycle_usec, 
+    initially with zero duty. Returns 0, or -1 with errno set -- EBUSY if
+    another PWM, on this pin or its partner, already has the channel. */
+int      pwm_hwpwm_setup (PWM *pwm);
+
+/** Set the channel's duty cycle from the PWM's current on-time. */
+void     pwm_hwpwm_update (PWM *pwm);
+
+/** Disable and unexport the channel, leaving the output low. */
+int      pwm_hwpwm_unsetup (PWM *pwm);
+
+END_DECLS
+
@@ -0,0 +1,216 @@
+/*============================================================================
+  
+  pwm_internal.h
+
+  Definitions shared between the PWM modules, but not part of the
+  public interface. Applications should include pwm.h only.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "pwm_stats.h"
+
+struct _PWMEngine;
+struct _GpioLines;
+
+// A pulse-width ramp, stepped once per cycle by the timing thread. Only
+//  the timing thread touches it; other threads post moves through 
+//  PWM.move
+typedef struct _PWMMotion
+  {
+  int from_usec; // On-time when the move started
+  int to_usec; // On-time when the move ends
+  int frames; // Length of the move, in cycles
+  int frame; // Cycles done; the move is over when frame == frames
+  int last_usec; // On-time that the last step stored
+  } PWMMotion;
+
+// PWM structure -- stores all internal data related to this
+//  PWM instance
+struct _PWM
+  {
+  int pin; // GPIO pin number
+  PWMBackend backend; // How the pin is driven
+  pthread_t pthread; // Reference to the running thread
+  BOOL running; // Set between a successful pwm_start() and pwm_stop()
+  BOOL threaded; // Set if pthread is a timing thread that must be joined
+  // Set when pwm_stop() is called, to stop the PWM thread. It is also the
+  //  futex that the thread sleeps on, so setting it wakes the thread
+  atomic_int stop;
+  int f_value; // Saved file handle for the 'value' pseudo-file (or, for
+               //  hardware PWM, the 'duty_cycle' file)
+  int cycle_usec; // PWM cycle-length, equals on_usec + off_usec
+  // "On" and "off" times in usec, packed into one word by 
+  //  pwm_pack_timing(), so that the timing thread can never see the
+  //  on-time from one update and the off-time from another
+  atomic_uint_least64_t timing; 
+  struct _PWMEngine *engine; // Engine that drives this pin, if any
+  int engine_group; // The engine's group for the pin's cycle length
+  struct _GpioLines *lines; // Character-device line request for the pin
+  BOOL own_lines; // Set if lines is ours, rather than shared by an engine
+  int phase_usec; // Start of the pulse within the engine's cycle
+  int min_pulse_usec; // Shorter pulses, or gaps, are dropped
+  int level; // Level last written by the timing thread, or -1
+  int64_t spin_ns; // Busy-wait before each edge, or zero to just sleep
+  BOOL pooled; // Set if the instance came from pwm_pool_create()
+  // A move posted by pwm_move_pulse_usec() that the timing thread has
+  //  not picked up yet, packed by pwm_pack_move(), or zero
+  atomic_uint_least64_t move;
+  PWMMotion motion; // The move in progress, if any
+  BOOL dither; // Set by pwm_set_dither()
+  // While dithering, the on-time that was asked for, in 1/65536 usec, 
+  //  of which the timing thread stores the whole part each cycle, 
+  //  rounded up or down so that the fractions it drops add up
+  atomic_uint_least64_t fine;
+  uint32_t dither_error; // Fraction carried, in 1/65536 usec
+  // Bumped by every setting of the on-time, and every move, from any 
+  //  thread, so that the timing thread can tell that the PWM has been
+  //  set, even to the on-time it already had
+  atomic_uint updates;
+  unsigned seen_updates; // Value of updates at the last pwm_idle_step()
+  int idle_msec; // Set by pwm_set_idle_timeout(), or zero
+  int64_t idle_since; // When the timing thread last saw the PWM set
+  BOOL idle; // Set while the idle timeout has stopped the pulses
+  // Set while the timing thread is parked, with the pin at a constant 
+  //  level, until the PWM is set again. The thread sleeps on it (see 
+  //  pwm_time_park())
+  atomic_int parked;
+  atomic_ulong overruns; // Edges written after the next was already due
+  PWMStatCounters stats; // Edge timing, kept by the timing thread
+  };
+
+BEGIN_DECLS
+
+/** Report an error from starting a PWM or an engine: format it into 
+    options->error_buf, if the caller supplied one, otherwise into a new
+    string at *error, if error is not NULL. */
+void     pwm_set_error (char **error, const PWMOptions *options, 
+           const char *fmt, ...) __attribute__ ((format (printf, 3, 4)));
+
+int      pwm_write_to_file (const char *filename, const char *text);
+void     pwm_resolve_backend (PWM *self);
+int      pwm_setup_pin (PWM *self);
+int      pwm_unsetup_pin (PWM *self);
+int      pwm_set_pin (PWM *self, int value);
+
+/** The busy-wait interval, in nsec, that the options call for. */
+int64_t  pwm_options_spin_ns (const PWMOptions *options);
+
+/** Tell the engine that drives the PWM that its duty has changed, so 
+    the table for its cycle length must be rebuilt. Safe to call from any
+    thread. */
+void     pwm_engine_changed (PWM *pwm);
+
+/** Ramp the on-time from its current value to target_usec, over the
+    given number of cycles. The ramp is computed by the timing thread, one
+    step per cycle, so the caller need only make this one call. Setting
+    the duty any other way cancels the ramp. On backends with no timing
+    thread, the pulse goes straight to target_usec. */
+void     pwm_move_pulse_usec (PWM *self, int target_usec, int frames);
+
+/** Advance the PWM's ramp, if it has one, by one cycle. Only the timing
+    thread may call this, once per cycle, before it loads the timing.
+    Returns TRUE if the on-time changed. */
+BOOL     pwm_motion_step (PWM *self);
+
+/** Note whether the PWM has been set since the last cycle, and, if it
+    has an idle timeout, whether it has now gone that long without, or
+    has just been set after going idle. Only the timing thread may call
+    this, once per cycle, before it loads the timing; now is the start
+    of the cycle. Returns TRUE if PWM.idle changed. */
+BOOL     pwm_idle_step (PWM *self, int64_t now);
+
+/** Store the next cycle's on-time, if the PWM is dithering. Only the 
+    timing thread may call this, once per cycle, after 
+    pwm_motion_step(). Returns TRUE if the on-time changed. */
+BOOL     pwm_dither_step (PWM *self);
+
+/** Pack on and off times into the form stored in PWM.timing. */
+static inline uint64_t pwm_pack_timing (int on_usec, int off_usec)
+  {
+  return ((uint64_t)(uint32_t)on_usec << 32) | (uint32_t)off_usec;
+  }
+
+/** Publish a new on/off pair. This is a single store, so it is safe
+    to call from any thread, with the timing thread running. */
+static inline void pwm_store_timing (PWM *self, int on_usec, int off_usec)
+  {
+  atomic_store_explicit (&self->timing, 
+    pwm_pack_timing (on_usec, off_usec), memory_order_release);
+  }
+
+/** Read the current on/off pair, as a consistent snapshot. The timing 
+    loops call this once per cycle, at the cycle boundary, so an update
+    takes effect at the start of the next cycle, never part-way through
+    one. */
+static inline void pwm_load_timing (PWM *self, int *on_usec, int *off_usec)
+  {
+  uint64_t t = atomic_load_explicit (&self->timing, memory_order_acquire);
+  *on_usec = (int)(uint32_t)(t >> 32);
+  *off_usec = (int)(uint32_t)t;
+  }
+
+/** Apply the minimum pulse width to an on/off pair: an on-time shorter 
+    than min_usec becomes fully off, and an off-time shorter than that 
+    becomes fully on. A pulse, or a gap, that the backend can't resolve 
+    would only come out as jitter, at the cost of two writes. */
+static inline void pwm_clamp_timing (int *on_usec, int *off_usec, 
+    int min_usec)
+  {
+  if (*on_usec != 0 && *on_usec < min_usec)
+    {
+    *off_usec += *on_usec;
+    *on_usec = 0;
+    }
+  else if (*off_usec != 0 && *off_usec < min_usec)
+    {
+    *on_usec += *off_usec;
+    *off_usec = 0;
+    }
+  }
+
+/** Whether the PWM's on-time is dithered. Backends with no timing 
+    thread to do it -- DMA, and hardware PWM -- can't be. */
+static inline BOOL pwm_dithers (const PWM *self)
+  {
+  return self->dither && self->backend != PWM_BACKEND_DMA 
+    && self->backend != PWM_BACKEND_HWPWM;
+  }
+
+/** Whether the timing thread is ramping the PWM's on-time, or has a 
+    move to start. */
+static inline BOOL pwm_ramping (PWM *self)
+  {
+  return atomic_load_explicit (&self->move, memory_order_relaxed) != 0
+    || self->motion.frame != self->motion.frames;
+  }
+
+/** Whether the PWM's timing stays the same from one cycle to the next
+    until something sets it -- that is, it is not ramping, nor dithering
+    a fraction of a usec. A steady PWM that is fully on or fully off 
+    needs nothing from the timing thread. */
+static inline BOOL pwm_steady (PWM *self)
+  {
+  return !pwm_ramping (self) && !(pwm_dithers (self) 
+    && (atomic_load_explicit (&self->fine, memory_order_relaxed) & 0xFFFF));
+  }
+
+/** Write the pin from a timing loop, unless the loop has already left it
+    at that level, in which case the write would be a wasted system call.
+    Returns TRUE if the pin was written. */
+static inline BOOL pwm_write_level (PWM *self, int level)
+  {
+  if (self->level == level) return FALSE;
+  pwm_set_pin (self, level);
+  self->level = level;
+  return TRUE;
+  }
+
+END_DECLS
+
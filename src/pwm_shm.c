@@ -0,0 +1,200 @@
+/*==========================================================================
+  
+    pwm_shm.c
+
+    The shared-memory control plane (see pwm_shm.h and 
+    pwm_shm_segment.h). The engine's timing
+    thread polls the segment at each cycle boundary, through the cycle
+    hook. The poll can't wait for a writer: if the sequence count hasn't
+    moved since the last poll, there's nothing to do, and if it shows a
+    writer part-way through an update, or changes while we're copying 
+    the on-times, we leave the channels alone and try again next cycle.
+    Either way, the poll costs one load when nothing has changed, and 
+    never makes a system call.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_engine.h" 
+#include "pwm_internal.h" 
+#include "pwm_shm.h" 
+
+struct _PWMShm
+  {
+  char *name; 
+  PWMShmSegment *seg;
+  PWMEngine *engine;
+  int num_channels;
+  PWM *pwms[PWM_SHM_MAX_CHANNELS];
+  unsigned last_seq; // Sequence count of the last update applied
+  unsigned applied[PWM_SHM_MAX_CHANNELS]; // On-times last applied
+  };
+
+/*============================================================================
+  pwm_shm_poll
+
+  The cycle hook, called by the timing thread.
+
+============================================================================*/
+static void pwm_shm_poll (void *arg)
+  {
+  PWMShm *self = (PWMShm *)arg;
+  PWMShmSegment *seg = self->seg;
+  unsigned seq = __atomic_load_n (&seg->seq, __ATOMIC_ACQUIRE);
+  if (seq == self->last_seq || (seq & 1)) return;
+
+  unsigned pulse[PWM_SHM_MAX_CHANNELS];
+  for (int i = 0; i < self->num_channels; i++)
+    pulse[i] = __atomic_load_n (&seg->pulse_usec[i], __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  if (__atomic_load_n (&seg->seq, __ATOMIC_RELAXED) != seq) return;
+
+  self->last_seq = seq;
+  for (int i = 0; i < self->num_channels; i++)
+    {
+    if (pulse[i] != self->applied[i])
+      {
+      self->applied[i] = pulse[i];
+      pwm_set_pulse_usec (self->pwms[i], 
+        pulse[i] > INT32_MAX ? INT32_MAX : (int)pulse[i]);
+      }
+    }
+  }
+
+/*============================================================================
+  pwm_shm_create
+============================================================================*/
+PWMShm *pwm_shm_create (const char *name, PWMEngine *engine, 
+    PWM *const *pwms, int num_pwms, char **error)
+  {
+  assert (name != NULL);
+  assert (engine != NULL);
+  if (num_pwms < 1 || num_pwms > PWM_SHM_MAX_CHANNELS)
+    {
+    pwm_set_error (error, NULL, "Shared memory needs 1-%d channels", 
+      PWM_SHM_MAX_CHANNELS);
+    return NULL;
+    }
+  for (int i = 0; i < num_pwms; i++)
+    {
+    if (pwms[i]->engine != engine)
+      {
+      pwm_set_error (error, NULL, "Pin %d is not driven by the engine", 
+        pwms[i]->pin);
+      return NULL;
+      }
+    }
+
+  // Group read-write, so that a client needn't be root
+  int fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+  if (fd < 0 && errno == EEXIST)
+    {
+    // Left behind by a process that didn't exit cleanly
+    shm_unlink (name);
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0660);
+    }
+  if (fd < 0)
+    {
+    pwm_set_error (error, NULL, "Can't create shared memory %s: %s", name, 
+      strerror (errno));
+    return NULL;
+    }
+  PWMShmSegment *seg = MAP_FAILED;
+  if (ftruncate (fd, sizeof (PWMShmSegment)) == 0)
+    seg = mmap (NULL, sizeof (PWMShmSegment), PROT_READ | PROT_WRITE, 
+      MAP_SHARED, fd, 0);
+  int saved_errno = errno;
+  close (fd);
+  if (seg == MAP_FAILED)
+    {
+    pwm_set_error (error, NULL, "Can't map shared memory %s: %s", name, 
+      strerror (saved_errno));
+    shm_unlink (name);
+    return NULL;
+    }
+
+  PWMShm *self = malloc (sizeof (PWMShm));
+  memset (self, 0, sizeof (PWMShm));
+  self->name = strdup (name);
+  self->seg = seg;
+  self->engine = engine;
+  self->num_channels = num_pwms;
+  memcpy (self->pwms, pwms, num_pwms * sizeof (PWM *));
+  seg->num_channels = num_pwms;
+  for (int i = 0; i < num_pwms; i++)
+    {
+    seg->pins[i] = pwms[i]->pin;
+    seg->cycle_usec[i] = pwms[i]->cycle_usec;
+    }
+  // The magic number goes in last, so that a client that maps the 
+  //  segment early sees either no segment, or a complete one
+  __atomic_store_n (&seg->magic, PWM_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  if (!pwm_engine_set_cycle_hook (engine, pwm_shm_poll, self))
+    {
+    pwm_set_error (error, NULL, "The engine is already running");
+    pwm_shm_destroy (self);
+    return NULL;
+    }
+  return self;
+  }
+
+/*============================================================================
+  pwm_shm_destroy
+============================================================================*/
+void pwm_shm_destroy (PWMShm *self)
+  {
+  if (self)
+    {
+    pwm_engine_set_cycle_hook (self->engine, NULL, NULL);
+    munmap (self->seg, sizeof (PWMShmSegment));
+    shm_unlink (self->name);
+    free (self->name);
+    free (self);
+    }
+  }
+
+/*============================================================================
+  pwm_shm_open
+============================================================================*/
+PWMShmSegment *pwm_shm_open (const char *name)
+  {
+  int fd = shm_open (name, O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) return NULL;
+  PWMShmSegment *seg = mmap (NULL, sizeof (PWMShmSegment), 
+    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int saved_errno = errno;
+  close (fd);
+  if (seg == MAP_FAILED)
+    {
+    errno = saved_errno;
+    return NULL;
+    }
+  if (__atomic_load_n (&seg->magic, __ATOMIC_ACQUIRE) != PWM_SHM_MAGIC)
+    {
+    munmap (seg, sizeof (PWMShmSegment));
+    errno = EPROTO;
+    return NULL;
+    }
+  return seg;
+  }
+
+/*============================================================================
+  pwm_shm_close
+============================================================================*/
+void pwm_shm_close (PWMShmSegment *seg)
+  {
+  if (seg) munmap (seg, sizeof (PWMShmSegment));
+  }
+
@@ -0,0 +1,45 @@
+/*============================================================================
+  
+  pwm_shm.h
+
+  A shared-memory control plane. The process that runs the PWM engine
+  creates a POSIX shared-memory segment holding one on-time per channel;
+  other processes map it, and set on-times with plain stores, with no
+  system calls at all, and the engine's timing thread picks them up at
+  the next cycle boundary.
+
+  The segment's layout, and the calls that clients use to write to it,
+  are in pwm_shm_segment.h, which is all that a client needs; this 
+  header is for the engine's process.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include "defs.h"
+#include "pwm.h"
+#include "pwm_engine.h"
+#include "pwm_shm_segment.h"
+
+struct _PWMShm;
+typedef struct _PWMShm PWMShm;
+
+BEGIN_DECLS
+
+/** Create the segment, with one channel per PWM, in the order given, 
+    and set it to be read by the engine's timing thread. The PWMs must 
+    all have been added to the engine, which must not be running yet, 
+    and the segment takes the engine's cycle hook. Channels start with
+    an on-time of zero. Returns NULL on failure, with *error filled in; 
+    the caller must free it. */
+PWMShm  *pwm_shm_create (const char *name, PWMEngine *engine, 
+           PWM *const *pwms, int num_pwms, char **error);
+
+/** Remove the segment. Stop the engine first. Clients that still have it
+    mapped can go on writing to it, but nothing reads it. */
+void     pwm_shm_destroy (PWMShm *self);
+
+END_DECLS
+
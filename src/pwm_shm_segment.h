@@ -0,0 +1,84 @@
+/*============================================================================
+
+  pwm_shm_segment.h
+
+  The layout of the shared-memory segment (see pwm_shm.h), and the calls
+  that a client uses to write to it. This header is all that a client
+  needs, in C or C++, apart from linking pwm_shm_open().
+
+  Writers bracket each batch of updates with pwm_shm_begin() and
+  pwm_shm_end(), which make up a sequence lock: the timing thread only
+  applies a set of on-times that no writer was part-way through, so the
+  channels in one batch always change in the same cycle. There should be
+  only one writer at a time.
+
+  The shared fields are plain uint32_t, accessed with the compiler's
+  __atomic builtins, rather than C11 atomic types, which C++ doesn't
+  have; the layout is the same either way.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include "defs.h"
+
+// Identifies a mapped segment, and its layout version
+#define PWM_SHM_MAGIC 0x324d5750 // "PWM2"
+
+#define PWM_SHM_MAX_CHANNELS 64
+
+// The segment's layout. The engine's process fills in everything but
+//  seq and pulse_usec before any client can see it, and never changes
+//  them afterwards
+typedef struct _PWMShmSegment
+  {
+  uint32_t magic; // PWM_SHM_MAGIC, stored last
+  uint32_t num_channels;
+  uint32_t pins[PWM_SHM_MAX_CHANNELS]; // GPIO number of each channel
+  uint32_t cycle_usec[PWM_SHM_MAX_CHANNELS]; // Cycle length of each channel
+  // Sequence count: odd while a writer is part-way through an update
+  uint32_t seq;
+  // On-time of each channel, in usec
+  uint32_t pulse_usec[PWM_SHM_MAX_CHANNELS];
+  } PWMShmSegment;
+
+BEGIN_DECLS
+
+/** Start a batch of updates. If the last writer died part-way through
+    one, this recovers from it. */
+static inline void pwm_shm_begin (PWMShmSegment *seg)
+  {
+  uint32_t seq = __atomic_load_n (&seg->seq, __ATOMIC_RELAXED);
+  __atomic_store_n (&seg->seq, (seq | 1) + (seq & 1 ? 2 : 0),
+    __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  }
+
+/** Set a channel's on-time, within a batch. */
+static inline void pwm_shm_set (PWMShmSegment *seg, int channel,
+    uint32_t pulse_usec)
+  {
+  __atomic_store_n (&seg->pulse_usec[channel], pulse_usec, __ATOMIC_RELAXED);
+  }
+
+/** Publish the batch. The new on-times take effect together, at the
+    start of the engine's next cycle. */
+static inline void pwm_shm_end (PWMShmSegment *seg)
+  {
+  uint32_t seq = __atomic_load_n (&seg->seq, __ATOMIC_RELAXED);
+  __atomic_store_n (&seg->seq, seq + 1, __ATOMIC_RELEASE);
+  }
+
+/** Map an existing segment, for a client, with shm_open() and mmap().
+    name is as for shm_open(), e.g. "/pi-servo". Returns NULL, with errno
+    set, if it can't be mapped, or isn't a PWM segment. */
+PWMShmSegment *pwm_shm_open (const char *name);
+
+/** Unmap a segment mapped by pwm_shm_open(). */
+void     pwm_shm_close (PWMShmSegment *seg);
+
+END_DECLS
+
@@ -0,0 +1,143 @@
+/*==========================================================================
+  
+    pwm_sim.c
+
+    The simulated pin backend. Writes go into a ring buffer of 
+    timestamped edges, with no I/O at all, so what's left to measure is
+    the cost and accuracy of the timing threads themselves.
+
+    The ring is written by any number of timing threads, and read by
+    one application thread, without locks. A writer takes a ticket from
+    the head counter, fills in the slot that the ticket maps to, and
+    then publishes the slot by storing ticket + 1 in its sequence
+    number. The reader takes the slot for ticket t only if its sequence
+    number is t + 1 both before and after copying it; a slot whose 
+    sequence number has moved past that has been overwritten, and the
+    edge is counted as dropped.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include "defs.h" 
+#include "pwm_time.h" 
+#include "pwm_sim.h" 
+
+typedef struct _PWMSimSlot
+  {
+  atomic_uint_least64_t seq; // Ticket + 1 once written; 0 while writing
+  atomic_int_least64_t time_ns;
+  atomic_int pin_level; // pin << 1 | level
+  } PWMSimSlot;
+
+static struct
+  {
+  PWMSimSlot ring[PWM_SIM_RING_SIZE];
+  atomic_uint_least64_t head; // Next ticket to hand out
+  uint64_t tail; // Next ticket to read; only the reader touches it
+  atomic_ulong dropped;
+  atomic_uint_least64_t levels; // Bit n is the level of pin n
+  } pwm_sim;
+
+/*============================================================================
+  pwm_sim_setup
+============================================================================*/
+int pwm_sim_setup (int pin)
+  {
+  if (pin < 0 || pin > PWM_SIM_MAX_PIN)
+    {
+    errno = EINVAL;
+    return -1;
+    }
+  atomic_fetch_and_explicit (&pwm_sim.levels, ~(1ULL << pin), 
+    memory_order_relaxed);
+  return 0;
+  }
+
+/*============================================================================
+  pwm_sim_write
+============================================================================*/
+void pwm_sim_write (int pin, int value)
+  {
+  int64_t now = pwm_time_now ();
+  if (value)
+    atomic_fetch_or_explicit (&pwm_sim.levels, 1ULL << pin, 
+      memory_order_relaxed);
+  else
+    atomic_fetch_and_explicit (&pwm_sim.levels, ~(1ULL << pin), 
+      memory_order_relaxed);
+
+  uint64_t ticket = atomic_fetch_add_explicit (&pwm_sim.head, 1, 
+    memory_order_relaxed);
+  PWMSimSlot *slot = &pwm_sim.ring[ticket & (PWM_SIM_RING_SIZE - 1)];
+  atomic_store_explicit (&slot->seq, 0, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  atomic_store_explicit (&slot->time_ns, now, memory_order_relaxed);
+  atomic_store_explicit (&slot->pin_level, pin << 1 | (value != 0), 
+    memory_order_relaxed);
+  atomic_store_explicit (&slot->seq, ticket + 1, memory_order_release);
+  }
+
+/*============================================================================
+  pwm_sim_read_edges
+============================================================================*/
+int pwm_sim_read_edges (PWMSimEdge *edges, int max)
+  {
+  uint64_t head = atomic_load_explicit (&pwm_sim.head, memory_order_acquire);
+  if (head - pwm_sim.tail > PWM_SIM_RING_SIZE)
+    {
+    // The writers have lapped us
+    uint64_t lost = head - PWM_SIM_RING_SIZE - pwm_sim.tail;
+    atomic_fetch_add_explicit (&pwm_sim.dropped, lost, memory_order_relaxed);
+    pwm_sim.tail += lost;
+    }
+  int n = 0;
+  while (n < max && pwm_sim.tail < head)
+    {
+    PWMSimSlot *slot = &pwm_sim.ring[pwm_sim.tail & (PWM_SIM_RING_SIZE - 1)];
+    uint64_t want = pwm_sim.tail + 1;
+    uint64_t seq = atomic_load_explicit (&slot->seq, memory_order_acquire);
+    if (seq == 0 || seq < want) break; // Ticket taken, but not written yet
+    if (seq == want)
+      {
+      int64_t time_ns = atomic_load_explicit (&slot->time_ns, 
+        memory_order_relaxed);
+      int pin_level = atomic_load_explicit (&slot->pin_level, 
+        memory_order_relaxed);
+      atomic_thread_fence (memory_order_acquire);
+      if (atomic_load_explicit (&slot->seq, memory_order_relaxed) == want)
+        {
+        edges[n].time_ns = time_ns;
+        edges[n].pin = pin_level >> 1;
+        edges[n].level = pin_level & 1;
+        n++;
+        pwm_sim.tail++;
+        continue;
+        }
+      }
+    atomic_fetch_add_explicit (&pwm_sim.dropped, 1, memory_order_relaxed);
+    pwm_sim.tail++;
+    }
+  return n;
+  }
+
+/*============================================================================
+  pwm_sim_get_dropped
+============================================================================*/
+unsigned long pwm_sim_get_dropped (void)
+  {
+  return atomic_load_explicit (&pwm_sim.dropped, memory_order_relaxed);
+  }
+
+/*============================================================================
+  pwm_sim_get_level
+============================================================================*/
+int pwm_sim_get_level (int pin)
+  {
+  if (pin < 0 || pin > PWM_SIM_MAX_PIN) return 0;
+  return (int)((atomic_load_explicit (&pwm_sim.levels, memory_order_relaxed)
+    >> pin) & 1);
+  }
+
@@ -0,0 +1,60 @@
+/*============================================================================
+  
+  pwm_sim.h
+
+  The simulated backend, PWM_BACKEND_SIM. Its pins are not real GPIOs:
+  each write is timestamped and logged in an in-memory ring buffer, 
+  which the application can drain with pwm_sim_read_edges(). This lets
+  the timing logic run, and be measured, on a machine with no GPIO at 
+  all.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// Edges held in the ring. Must be a power of two. When the ring is full,
+//  the oldest edges are overwritten, and counted as dropped
+#ifndef PWM_SIM_RING_SIZE
+#define PWM_SIM_RING_SIZE 4096
+#endif
+
+// Simulated pins are 0 to this
+#define PWM_SIM_MAX_PIN 63
+
+// One logged pin write
+typedef struct _PWMSimEdge
+  {
+  int64_t time_ns; // On CLOCK_MONOTONIC
+  int pin;
+  int level;
+  } PWMSimEdge;
+
+BEGIN_DECLS
+
+/** Copy up to max logged edges, oldest first, into edges, and remove
+    them from the ring. Returns the number copied. Only one thread may
+    read the ring, but any number of timing threads may be writing it 
+    at the same time. */
+int      pwm_sim_read_edges (PWMSimEdge *edges, int max);
+
+/** The number of edges that were overwritten before they could be 
+    read. */
+unsigned long pwm_sim_get_dropped (void);
+
+/** The level that a simulated pin was last driven to. */
+int      pwm_sim_get_level (int pin);
+
+/** Set up a simulated pin -- just check the pin number, and start it
+    low. Returns 0, or -1 with errno set. Called from pwm.c. */
+int      pwm_sim_setup (int pin);
+
+/** Drive a simulated pin, logging the edge. Called from the timing 
+    threads, through pwm_set_pin(). */
+void     pwm_sim_write (int pin, int value);
+
+END_DECLS
+
@@ -0,0 +1,95 @@
+/*==========================================================================
+  
+    pwm_stats.c
+
+    Reading the edge-timing statistics. The timing threads only ever
+    bump counters (see pwm_stats.h); all the work of turning the 
+    histogram into percentiles is done here, in the caller's thread.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <string.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_stats.h" 
+
+/*============================================================================
+  pwm_stats_bucket_ns
+
+  The middle of a histogram bucket, in nsec.
+
+============================================================================*/
+static int64_t pwm_stats_bucket_ns (int b)
+  {
+  if (b < PWM_STATS_LINEAR) return b * 1000LL + 500;
+  int octave = ((b - PWM_STATS_LINEAR) >> PWM_STATS_SUB_BITS) + 6;
+  int sub = (b - PWM_STATS_LINEAR) & ((1 << PWM_STATS_SUB_BITS) - 1);
+  int shift = octave - PWM_STATS_SUB_BITS;
+  int64_t low = ((int64_t)((1 << PWM_STATS_SUB_BITS) + sub)) << shift;
+  return (low * 2 + ((int64_t)1 << shift)) * 500;
+  }
+
+/*============================================================================
+  pwm_stats_read
+============================================================================*/
+void pwm_stats_read (PWMStatCounters *self, PWMStats *stats)
+  {
+  memset (stats, 0, sizeof (PWMStats));
+  stats->cycles = atomic_load_explicit (&self->cycles, memory_order_relaxed);
+  stats->edges = atomic_load_explicit (&self->edges, memory_order_relaxed);
+  if (stats->edges == 0) return;
+  stats->min_late_ns = atomic_load_explicit (&self->min_late_ns, 
+    memory_order_relaxed);
+  stats->max_late_ns = atomic_load_explicit (&self->max_late_ns, 
+    memory_order_relaxed);
+
+  unsigned long counts[PWM_STATS_BUCKETS];
+  unsigned long total = 0;
+  for (int b = 0; b < PWM_STATS_BUCKETS; b++)
+    {
+    counts[b] = atomic_load_explicit (&self->buckets[b], 
+      memory_order_relaxed);
+    total += counts[b];
+    }
+  unsigned long p50 = (total + 1) / 2;
+  unsigned long p99 = total - total / 100;
+  unsigned long seen = 0;
+  BOOL have_p50 = FALSE;
+  for (int b = 0; b < PWM_STATS_BUCKETS; b++)
+    {
+    seen += counts[b];
+    if (!have_p50 && seen >= p50)
+      {
+      stats->p50_late_ns = pwm_stats_bucket_ns (b);
+      have_p50 = TRUE;
+      }
+    if (seen >= p99)
+      {
+      stats->p99_late_ns = pwm_stats_bucket_ns (b);
+      break;
+      }
+    }
+  // A bucket's midpoint can lie outside the range actually seen
+  if (stats->p50_late_ns > stats->max_late_ns) 
+    stats->p50_late_ns = stats->max_late_ns;
+  if (stats->p99_late_ns > stats->max_late_ns) 
+    stats->p99_late_ns = stats->max_late_ns;
+  if (stats->p50_late_ns < stats->min_late_ns) 
+    stats->p50_late_ns = stats->min_late_ns;
+  if (stats->p99_late_ns < stats->min_late_ns) 
+    stats->p99_late_ns = stats->min_late_ns;
+  }
+
+/*============================================================================
+  pwm_stats_reset
+============================================================================*/
+void pwm_stats_reset (PWMStatCounters *self)
+  {
+  atomic_store_explicit (&self->edges, 0, memory_order_relaxed);
+  atomic_store_explicit (&self->cycles, 0, memory_order_relaxed);
+  for (int b = 0; b < PWM_STATS_BUCKETS; b++)
+    atomic_store_explicit (&self->buckets[b], 0, memory_order_relaxed);
+  }
+
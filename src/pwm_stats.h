@@ -0,0 +1,89 @@
+/*============================================================================
+  
+  pwm_stats.h
+
+  Edge-timing statistics, collected by the timing threads: how late each
+  edge was written, compared with when it was scheduled, as a histogram,
+  plus counts of cycles and edges. Not part of the public interface -- 
+  applications read the statistics with pwm_get_stats().
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Lateness histogram buckets. Up to 64 usec, each bucket is 1 usec wide;
+//  above that, each power of two is split into eight, so a bucket is
+//  never wider than an eighth of its value. The last bucket takes 
+//  everything from about 30 sec up
+#define PWM_STATS_LINEAR 64
+#define PWM_STATS_SUB_BITS 3
+#define PWM_STATS_OCTAVES 19
+#define PWM_STATS_BUCKETS \
+  (PWM_STATS_LINEAR + (PWM_STATS_OCTAVES << PWM_STATS_SUB_BITS))
+
+// The counters. Only the timing thread that drives the PWM writes them,
+//  so every update is a relaxed load and store, with no locked 
+//  read-modify-write; readers get a snapshot that may be a few edges 
+//  out of step between fields, but never a torn value
+typedef struct _PWMStatCounters
+  {
+  atomic_ulong cycles; 
+  atomic_ulong edges; 
+  atomic_int_least64_t min_late_ns; 
+  atomic_int_least64_t max_late_ns;
+  atomic_ulong buckets[PWM_STATS_BUCKETS];
+  } PWMStatCounters;
+
+BEGIN_DECLS
+
+/** The histogram bucket for a lateness of late_usec. */
+static inline int pwm_stats_bucket (int64_t late_usec)
+  {
+  if (late_usec < PWM_STATS_LINEAR) return late_usec < 0 ? 0 : late_usec;
+  int octave = 63 - __builtin_clzll ((uint64_t)late_usec);
+  int shift = octave - PWM_STATS_SUB_BITS;
+  int b = PWM_STATS_LINEAR 
+    + ((octave - 6) << PWM_STATS_SUB_BITS)
+    + (int)((late_usec >> shift) & ((1 << PWM_STATS_SUB_BITS) - 1));
+  return b < PWM_STATS_BUCKETS ? b : PWM_STATS_BUCKETS - 1;
+  }
+
+/** Add one to a counter that only this thread writes. */
+static inline void pwm_stats_bump (atomic_ulong *counter)
+  {
+  atomic_store_explicit (counter, 
+    atomic_load_explicit (counter, memory_order_relaxed) + 1, 
+    memory_order_relaxed);
+  }
+
+/** Record an edge that was scheduled for one time, and written at 
+    another. Called only by the timing thread. */
+static inline void pwm_stats_edge (PWMStatCounters *self, int64_t scheduled,
+    int64_t written)
+  {
+  int64_t late_ns = written - scheduled;
+  unsigned long edges = atomic_load_explicit (&self->edges, 
+    memory_order_relaxed);
+  if (edges == 0 || late_ns < atomic_load_explicit (&self->min_late_ns, 
+       memory_order_relaxed))
+    atomic_store_explicit (&self->min_late_ns, late_ns, memory_order_relaxed);
+  if (edges == 0 || late_ns > atomic_load_explicit (&self->max_late_ns, 
+       memory_order_relaxed))
+    atomic_store_explicit (&self->max_late_ns, late_ns, memory_order_relaxed);
+  atomic_store_explicit (&self->edges, edges + 1, memory_order_relaxed);
+  pwm_stats_bump (&self->buckets[pwm_stats_bucket (late_ns / 1000)]);
+  }
+
+/** Take a snapshot of the counters. */
+void     pwm_stats_read (PWMStatCounters *self, PWMStats *stats);
+
+/** Zero the counters. Edges recorded while this runs may be lost. */
+void     pwm_stats_reset (PWMStatCounters *self);
+
+END_DECLS
+
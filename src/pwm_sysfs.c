@@ -0,0 +1,175 @@
+/*==========================================================================
+  
+    pwm_sysfs.c
+
+    Bulk pin setup for the sysfs backend. Writing a pin number to 
+    'export' creates the gpioN directory at once, but on most systems 
+    its 'direction' and 'value' files are only made writable by the 
+    'gpio' group a little later, when udev gets round to it. Rather than
+    sleeping for a fixed time after each export, we export every pin 
+    first, then keep trying the pins that aren't ready yet, waiting on
+    inotify between attempts: udev's chown and chmod generate IN_ATTRIB
+    events on the attribute files, so the pins are retried when udev 
+    has done something, and otherwise only at the setup deadline. The 
+    kernel doesn't report the files it creates itself through inotify, 
+    though, so while a pin's directory hasn't appeared -- which export
+    normally creates before it returns -- or if there's no inotify, we 
+    retry every PWM_SYSFS_RETRY_MSEC.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_internal.h" 
+#include "pwm_time.h" 
+#include "pwm_sysfs.h" 
+
+// Wait between attempts to set up the pins, when inotify can't tell us
+//  when to try again
+#define PWM_SYSFS_RETRY_MSEC 5
+
+/*============================================================================
+  pwm_sysfs_try_pin
+
+  Set the pin to be an output, and open its value file, if its 
+  attributes are writable yet. Returns 0 if it's been set up, or -1 with
+  errno set.
+
+============================================================================*/
+static int pwm_sysfs_try_pin (PWM *self)
+  {
+  char s[64];
+  snprintf (s, sizeof (s), PWM_SYSFS_GPIO "/gpio%d/direction", self->pin);
+  int fd = open (s, O_WRONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  // "low" sets the direction to output, with the pin driven low, in one
+  //  write, so the pin never glitches high
+  ssize_t n = write (fd, "low", 3);
+  int saved_errno = errno;
+  close (fd);
+  if (n < 0)
+    {
+    errno = saved_errno;
+    return -1;
+    }
+  snprintf (s, sizeof (s), PWM_SYSFS_GPIO "/gpio%d/value", self->pin);
+  self->f_value = open (s, O_WRONLY | O_CLOEXEC);
+  return self->f_value >= 0 ? 0 : -1;
+  }
+
+/*============================================================================
+  pwm_sysfs_watch
+
+  Ask for inotify events that suggest the pin might be ready: a change to
+  its direction file's owner or mode. Returns FALSE if the file isn't 
+  there yet, so can't be watched.
+
+============================================================================*/
+static BOOL pwm_sysfs_watch (int inotify_fd, int pin)
+  {
+  char s[64];
+  snprintf (s, sizeof (s), PWM_SYSFS_GPIO "/gpio%d/direction", pin);
+  return inotify_add_watch (inotify_fd, s, IN_ATTRIB) >= 0;
+  }
+
+/*============================================================================
+  pwm_sysfs_setup
+============================================================================*/
+int pwm_sysfs_setup (PWM **pwms, int num_pwms)
+  {
+  int export_fd = open (PWM_SYSFS_GPIO "/export", O_WRONLY | O_CLOEXEC);
+  if (export_fd < 0) return -1;
+  for (int i = 0; i < num_pwms; i++)
+    pwms[i]->f_value = -1;
+  for (int i = 0; i < num_pwms; i++)
+    {
+    // A pin that is already exported fails with EBUSY, which is fine. 
+    //  Anything else means the pin doesn't exist, and waiting won't help
+    char s[16];
+    int len = snprintf (s, sizeof (s), "%d", pwms[i]->pin);
+    if (write (export_fd, s, len) < 0 && errno != EBUSY)
+      {
+      int saved_errno = errno;
+      close (export_fd);
+      while (--i >= 0)
+        pwm_sysfs_unsetup (pwms[i]);
+      errno = saved_errno;
+      return -1;
+      }
+    }
+  close (export_fd);
+
+  int inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+  int64_t deadline = pwm_time_now () 
+    + PWM_SYSFS_SETUP_TIMEOUT_MSEC * 1000 * PWM_NSEC_PER_USEC;
+  int pending = num_pwms;
+  int err = 0;
+  while (pending > 0)
+    {
+    pending = 0;
+    BOOL watched = inotify_fd >= 0;
+    for (int i = 0; i < num_pwms; i++)
+      {
+      if (pwms[i]->f_value >= 0) continue;
+      // Watch before trying, so that a change between a failed attempt
+      //  and the wait still wakes us
+      if (inotify_fd >= 0 && !pwm_sysfs_watch (inotify_fd, pwms[i]->pin))
+        watched = FALSE;
+      if (pwm_sysfs_try_pin (pwms[i]) == 0) continue;
+      err = errno;
+      pending++;
+      }
+    if (pending == 0) break;
+
+    int64_t now = pwm_time_now ();
+    if (now >= deadline) break;
+    int wait_msec = (int)((deadline - now) / (1000 * PWM_NSEC_PER_USEC)) + 1;
+    if (!watched && wait_msec > PWM_SYSFS_RETRY_MSEC) 
+      wait_msec = PWM_SYSFS_RETRY_MSEC;
+    if (inotify_fd >= 0)
+      {
+      struct pollfd pfd = { .fd = inotify_fd, .events = POLLIN };
+      if (poll (&pfd, 1, wait_msec) > 0)
+        {
+        char events[4096];
+        while (read (inotify_fd, events, sizeof (events)) > 0);
+        }
+      }
+    else
+      usleep (wait_msec * 1000);
+    }
+  if (inotify_fd >= 0) close (inotify_fd);
+
+  if (pending > 0)
+    {
+    for (int i = 0; i < num_pwms; i++)
+      pwm_sysfs_unsetup (pwms[i]);
+    errno = err;
+    return -1;
+    }
+  return 0;
+  }
+
+/*============================================================================
+  pwm_sysfs_unsetup
+============================================================================*/
+int pwm_sysfs_unsetup (PWM *self)
+  {
+  char s[16];
+  snprintf (s, sizeof (s), "%d", self->pin);
+  int ret = pwm_write_to_file (PWM_SYSFS_GPIO "/unexport", s);
+  if (self->f_value >= 0)
+    close (self->f_value);
+  self->f_value = -1;
+  return ret;
+  }
+
@@ -0,0 +1,38 @@
+/*============================================================================
+  
+  pwm_sysfs.h
+
+  Setting up pins for the sysfs backend, /sys/class/gpio. These functions
+  are called from pwm.c and pwm_engine.c, and are not part of the public
+  interface.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#define PWM_SYSFS_GPIO "/sys/class/gpio"
+
+// How long to wait for the exported pins' attributes to become usable,
+//  in msec, before giving up
+#ifndef PWM_SYSFS_SETUP_TIMEOUT_MSEC
+#define PWM_SYSFS_SETUP_TIMEOUT_MSEC 1000
+#endif
+
+BEGIN_DECLS
+
+/** Export all the pins, set them to outputs, driven low, and open their
+    'value' files into PWM.f_value. The pins are exported in one pass,
+    and then set up as their attributes become writable -- which, for a
+    process that is not root, is when udev has changed their group. So 
+    setting up many pins takes about as long as setting up one. Returns
+    0, or -1 with errno set, in which case none of the pins is left set 
+    up. */
+int      pwm_sysfs_setup (PWM **pwms, int num_pwms);
+
+/** Close the pin's 'value' file, and unexport it. */
+int      pwm_sysfs_unsetup (PWM *self);
+
+END_DECLS
+
@@ -0,0 +1,161 @@
+/*==========================================================================
+  
+    pwm_table.c
+
+    Compiles the channels' on/off times into the table that the engine's
+    timing loop walks. All the decisions -- which channels are fully on
+    or off, where pulses wrap around the end of the cycle, which edges
+    coincide and which backend each pin is on -- are made here, once, 
+    when something changes, rather than at every edge.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <string.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_internal.h" 
+#include "pwm_table.h" 
+
+/*============================================================================
+  pwm_table_add_edge
+============================================================================*/
+static void pwm_table_add_edge (PWMTable *table, int offset_usec, 
+    int deadline_usec, int level, PWM *pwm)
+  {
+  PWMTableEdge *e = &table->edges[table->num_edges++];
+  e->offset_usec = offset_usec;
+  e->deadline_usec = deadline_usec;
+  e->level = level;
+  e->pwm = pwm;
+  }
+
+/*============================================================================
+  pwm_table_sort
+
+  Insertion sort -- the list is short, and mostly ordered already when 
+  the channels are in phase, because all the rising edges are at offset 
+  zero. It is also stable, which keeps a channel's carried falling edge
+  ahead of a rising edge at the same offset.
+
+============================================================================*/
+static void pwm_table_sort (PWMTable *table)
+  {
+  PWMTableEdge *edges = table->edges;
+  for (int i = 1; i < table->num_edges; i++)
+    {
+    PWMTableEdge e = edges[i];
+    int j = i - 1;
+    while (j >= 0 && edges[j].offset_usec > e.offset_usec)
+      {
+      edges[j + 1] = edges[j];
+      j--;
+      }
+    edges[j + 1] = e;
+    }
+  }
+
+/*============================================================================
+  pwm_table_merge
+
+  Group the sorted edges into one entry per distinct offset.
+
+============================================================================*/
+static void pwm_table_merge (PWMTable *table)
+  {
+  PWMTableEntry *entry = NULL;
+  table->num_entries = 0;
+  for (int i = 0; i < table->num_edges; i++)
+    {
+    PWMTableEdge *e = &table->edges[i];
+    if (!entry || e->offset_usec != entry->offset_usec)
+      {
+      entry = &table->entries[table->num_entries++];
+      memset (entry, 0, sizeof (PWMTableEntry));
+      entry->offset_usec = e->offset_usec;
+      entry->deadline_usec = e->deadline_usec;
+      entry->first_edge = i;
+      }
+    entry->num_edges++;
+    if (e->deadline_usec < entry->deadline_usec)
+      entry->deadline_usec = e->deadline_usec;
+
+    int b;
+    switch (e->pwm->backend)
+      {
+      case PWM_BACKEND_GPIOMEM: b = PWM_TABLE_GPIOMEM; break;
+      case PWM_BACKEND_CHARDEV: b = PWM_TABLE_CHARDEV; break;
+      default: b = -1; entry->has_unmasked = TRUE;
+      }
+    if (b >= 0)
+      {
+      uint64_t bit = 1ULL << e->pwm->pin;
+      if (e->level)
+        entry->set[b] |= bit;
+      else
+        entry->clr[b] |= bit;
+      }
+    }
+  }
+
+/*============================================================================
+  pwm_table_build
+
+  A channel that is fully on or fully off gets one edge in the first 
+  table that has it at that level, and none in the tables after, until
+  it changes; so a group of channels that are all held has an empty
+  table, and the engine can stop waking up for it. A channel whose 
+  pulse starts late enough in the cycle to overrun the end has its 
+  falling edge put into the next cycle's table instead, so that the 
+  pulse is the width it was when it started, even if the duty changes 
+  at the cycle boundary. 
+
+============================================================================*/
+BOOL pwm_table_build (PWMTable *table, PWMTableChannel *channels, 
+    int num_channels, int cycle_usec, int min_pulse_usec)
+  {
+  BOOL changed = FALSE;
+  table->num_edges = 0;
+  for (int i = 0; i < num_channels; i++)
+    {
+    PWMTableChannel *c = &channels[i];
+    PWM *pwm = c->pwm;
+    if (pwm->backend == PWM_BACKEND_HWPWM) continue; // Timed by hardware
+    int phase = c->phase_usec;
+    int on_usec, off_usec;
+    pwm_load_timing (pwm, &on_usec, &off_usec);
+    if (pwm->idle)
+      {
+      off_usec += on_usec;
+      on_usec = 0;
+      }
+    pwm_clamp_timing (&on_usec, &off_usec, min_pulse_usec);
+    int level = on_usec == 0 ? 0 : off_usec == 0 ? 1 : -1;
+    BOOL held = level >= 0 && level == c->level && c->carry_usec < 0;
+    if (level != c->level) changed = TRUE;
+    c->level = level;
+    if (held) continue;
+
+    if (c->carry_usec >= 0)
+      pwm_table_add_edge (table, c->carry_usec, phase, 0, pwm);
+    int carry = -1;
+    if (on_usec != 0)
+      pwm_table_add_edge (table, phase, 
+        phase + (off_usec != 0 ? on_usec : cycle_usec), 1, pwm);
+    if (off_usec != 0)
+      {
+      int fall = phase + on_usec;
+      if (fall < cycle_usec)
+        pwm_table_add_edge (table, fall, phase + cycle_usec, 0, pwm);
+      else
+        carry = fall - cycle_usec;
+      }
+    if (carry != c->carry_usec) changed = TRUE;
+    c->carry_usec = carry;
+    }
+  pwm_table_sort (table);
+  pwm_table_merge (table);
+  return changed;
+  }
+
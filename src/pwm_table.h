@@ -0,0 +1,95 @@
+/*============================================================================
+  
+  pwm_table.h
+
+  Precomputed cycle tables for the PWM engine: the edges of one cycle,
+  for all channels, merged by time into (offset, set mask, clear mask)
+  entries. Not part of the public interface.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// Channels per table. Pins are held as bits in 64-bit masks, and the
+//  character device allows 64 lines per request, so there's no point
+//  in more than this
+#define PWM_TABLE_MAX_CHANNELS 64
+
+// At most three edges per channel per cycle: a falling edge carried over
+//  from the previous cycle, and a rising and falling edge of its own
+#define PWM_TABLE_MAX_EDGES (3 * PWM_TABLE_MAX_CHANNELS)
+
+// The backends whose edges can be merged into masks, by index into
+//  PWMTableEntry.set and .clr. Sysfs edges have to be written one pin at 
+//  a time, so they are kept as a list
+#define PWM_TABLE_GPIOMEM 0
+#define PWM_TABLE_CHARDEV 1
+#define PWM_TABLE_MASKS 2
+
+// One edge: at offset_usec from the start of the cycle, set the 
+//  channel's pin to level. If we don't get to it until after 
+//  deadline_usec, when the channel's next edge is due, the edge has been
+//  missed altogether, and counts as an overrun.
+typedef struct _PWMTableEdge
+  {
+  int offset_usec;
+  int deadline_usec;
+  int level;
+  PWM *pwm;
+  } PWMTableEdge;
+
+// All the edges that fall at one offset
+typedef struct _PWMTableEntry
+  {
+  int offset_usec;
+  int deadline_usec; // Earliest deadline of any of the edges
+  uint64_t set[PWM_TABLE_MASKS]; // Pins to drive high, by backend
+  uint64_t clr[PWM_TABLE_MASKS]; // Pins to drive low, by backend
+  BOOL has_unmasked; // Set if any edge is on a pin written by itself --
+                     //  a sysfs or simulated pin
+  int first_edge; // Index of the entry's edges in PWMTable.edges
+  int num_edges;
+  } PWMTableEntry;
+
+typedef struct _PWMTable
+  {
+  int num_entries;
+  int num_edges;
+  PWMTableEntry entries[PWM_TABLE_MAX_EDGES];
+  PWMTableEdge edges[PWM_TABLE_MAX_EDGES]; // Sorted by offset
+  } PWMTable;
+
+// What the table is built from, for each channel
+typedef struct _PWMTableChannel
+  {
+  PWM *pwm;
+  int phase_usec; // Start of the pulse within the cycle
+  // Where a pulse runs past the end of the cycle, its falling edge is
+  //  carried into the start of the next one. This is the offset of that
+  //  edge, or -1 if there isn't one.
+  int carry_usec;
+  // The level that the channel is held at, fully on or fully off, once 
+  //  a table has had the edge that set it, or -1. Later tables leave 
+  //  the channel out until its timing changes
+  int level;
+  } PWMTableChannel;
+
+BEGIN_DECLS
+
+/** Build the table for the next cycle, from the channels' current on/off
+    times and phases, and the edges carried over from the previous table.
+    The carries, and held levels, are updated for the cycle after. 
+    Returns TRUE if any of them changed, in which case the cycle after 
+    next will need a table of its own, even if no duty changes. On-times
+    and off-times shorter than min_pulse_usec are clamped, as in 
+    pwm_loop, and channels that have gone idle (see 
+    pwm_set_idle_timeout()) are fully off. */
+BOOL     pwm_table_build (PWMTable *table, PWMTableChannel *channels, 
+           int num_channels, int cycle_usec, int min_pulse_usec);
+
+END_DECLS
+
@@ -0,0 +1,100 @@
+/*==========================================================================
+  
+    pwm_thread.c
+
+    Creation of PWM timing threads. An ordinary SCHED_OTHER thread can
+    be held up for milliseconds by whatever else is running, so callers
+    can ask for the thread to run SCHED_FIFO, to be confined to one CPU 
+    (ideally one that has been kept free of other tasks with the
+    'isolcpus' kernel parameter), and for the process's memory to be
+    locked, so the timing loop never waits for a page fault.
+
+    All of these generally need root, or CAP_SYS_NICE and CAP_IPC_LOCK,
+    so each failure is reported, rather than quietly running without.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_internal.h" 
+#include "pwm_thread.h" 
+
+/*============================================================================
+  pwm_thread_start
+============================================================================*/
+BOOL pwm_thread_start (pthread_t *thread, void *(*fn)(void *), void *arg, 
+    const PWMOptions *options, char **error)
+  {
+  int rt_priority = options ? options->rt_priority : 0;
+  int cpu = options ? options->cpu : -1;
+
+  if (options && options->lock_memory)
+    {
+    if (mlockall (MCL_CURRENT | MCL_FUTURE) != 0)
+      {
+      pwm_set_error (error, options, "Can't lock memory: %s",
+        strerror (errno));
+      return FALSE;
+      }
+    }
+
+  pthread_attr_t attr;
+  pthread_attr_init (&attr);
+  int err = 0;
+  if (rt_priority > 0)
+    {
+    struct sched_param param;
+    memset (&param, 0, sizeof (param));
+    param.sched_priority = rt_priority;
+    pthread_attr_setinheritsched (&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy (&attr, SCHED_FIFO);
+    err = pthread_attr_setschedparam (&attr, &param);
+    if (err != 0)
+      {
+      pwm_set_error (error, options, "Invalid SCHED_FIFO priority %d: %s",
+        rt_priority, strerror (err));
+      pthread_attr_destroy (&attr);
+      return FALSE;
+      }
+    }
+  if (cpu >= CPU_SETSIZE)
+    {
+    pwm_set_error (error, options, "Can't start PWM thread on CPU %d: %s", 
+      cpu, strerror (EINVAL));
+    pthread_attr_destroy (&attr);
+    return FALSE;
+    }
+  if (cpu >= 0)
+    {
+    cpu_set_t cpus;
+    CPU_ZERO (&cpus);
+    CPU_SET (cpu, &cpus);
+    pthread_attr_setaffinity_np (&attr, sizeof (cpus), &cpus);
+    }
+
+  err = pthread_create (thread, &attr, fn, arg);
+  pthread_attr_destroy (&attr);
+  if (err != 0)
+    {
+    if (err == EPERM && rt_priority > 0)
+      pwm_set_error (error, options, "Can't start PWM thread with "
+        "SCHED_FIFO priority %d: %s", rt_priority, strerror (err));
+    else if (err == EINVAL && cpu >= 0)
+      pwm_set_error (error, options, "Can't start PWM thread on CPU %d: %s",
+        cpu, strerror (err));
+    else
+      pwm_set_error (error, options, "Can't start PWM thread: %s",
+        strerror (err));
+    return FALSE;
+    }
+  return TRUE;
+  }
+
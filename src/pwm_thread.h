@@ -0,0 +1,26 @@
+/*============================================================================
+  
+  pwm_thread.h
+
+  Starting timing threads with the scheduling, CPU affinity and memory
+  locking that PWMOptions ask for.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <pthread.h>
+
+BEGIN_DECLS
+
+/** Create a thread running fn(arg), applying any real-time options.
+    options may be NULL, for an ordinary thread. If the thread can't be
+    created with the requested options, no thread is created, the error
+    is reported with pwm_set_error(), and FALSE is returned. */
+BOOL     pwm_thread_start (pthread_t *thread, void *(*fn)(void *), 
+           void *arg, const PWMOptions *options, char **error);
+
+END_DECLS
+
@@ -0,0 +1,137 @@
+/*==========================================================================
+  
+    pwm_time.c
+
+    Absolute-deadline sleeping for the PWM timing loops. Sleeping to an
+    absolute time, rather than for an interval, means that the time 
+    spent writing to the pins, and the scheduler's wakeup latency, 
+    do not add up from one edge to the next: each edge is aimed at its 
+    correct place on the timeline, however late the previous one was.
+
+    For edges that need to be more accurate than the scheduler can wake
+    us -- typically 50-100 usec late on a Pi 3B+ -- we can sleep until a
+    "guard" interval before the edge, and then spin on the clock.
+
+    The sleep is a futex wait on the timing thread's stop flag, with an
+    absolute timeout on the monotonic clock, so that stopping the thread
+    wakes it at once, rather than after the rest of the cycle.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "defs.h" 
+#include "pwm_time.h" 
+
+/*============================================================================
+  pwm_time_wait
+
+  Sleep on the futex word until the deadline, for as long as it holds
+  value and *stop is clear. Returns TRUE if the deadline was reached.
+
+============================================================================*/
+static BOOL pwm_time_wait (atomic_int *word, int value, int64_t deadline, 
+    int64_t spin_ns, atomic_int *stop)
+  {
+  BOOL forever = deadline == PWM_TIME_FOREVER;
+  int64_t wake = deadline - spin_ns;
+  struct timespec ts;
+  ts.tv_sec = wake / PWM_NSEC_PER_SEC;
+  ts.tv_nsec = wake % PWM_NSEC_PER_SEC;
+  // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout. It
+  //  returns at once if the word has already changed, and may return 
+  //  early for no reason, so loop until the time is up or we're woken
+  while (atomic_load_explicit (word, memory_order_acquire) == value
+      && !atomic_load_explicit (stop, memory_order_acquire))
+    {
+    if (syscall (SYS_futex, word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+         value, forever ? NULL : &ts, NULL, FUTEX_BITSET_MATCH_ANY) != 0 
+        && errno == ETIMEDOUT)
+      break;
+    }
+  if (spin_ns && !forever)
+    {
+    // Reading the clock is a vDSO call, not a real system call, so this
+    //  loop doesn't enter the kernel.
+    while (pwm_time_now () < deadline)
+      if (atomic_load_explicit (word, memory_order_relaxed) != value 
+          || atomic_load_explicit (stop, memory_order_relaxed)) break;
+    }
+  return atomic_load_explicit (word, memory_order_acquire) == value
+    && !atomic_load_explicit (stop, memory_order_acquire);
+  }
+
+/*============================================================================
+  pwm_time_sleep_until
+============================================================================*/
+BOOL pwm_time_sleep_until (int64_t deadline, int64_t spin_ns, 
+    atomic_int *stop)
+  {
+  if (stop) return pwm_time_wait (stop, 0, deadline, spin_ns, stop);
+
+  int64_t wake = deadline - spin_ns;
+  struct timespec ts;
+  ts.tv_sec = wake / PWM_NSEC_PER_SEC;
+  ts.tv_nsec = wake % PWM_NSEC_PER_SEC;
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) 
+      == EINTR);
+  if (spin_ns)
+    while (pwm_time_now () < deadline);
+  return TRUE;
+  }
+
+/*============================================================================
+  pwm_time_park
+============================================================================*/
+BOOL pwm_time_park (atomic_int *parked, int64_t deadline, int64_t spin_ns,
+    atomic_int *stop)
+  {
+  return pwm_time_wait (parked, TRUE, deadline, spin_ns, stop);
+  }
+
+/*============================================================================
+  pwm_time_unpark
+
+  The barrier orders the caller's stores -- the new duty, say -- before 
+  the load of *parked, just as the parking thread's store to *parked is
+  ordered before its last check for work. So either the caller sees 
+  that the thread is parking, and wakes it, or the thread sees the new
+  work, and doesn't park.
+
+============================================================================*/
+void pwm_time_unpark (atomic_int *parked)
+  {
+  atomic_thread_fence (memory_order_seq_cst);
+  if (atomic_load_explicit (parked, memory_order_relaxed)
+      && atomic_exchange (parked, FALSE))
+    syscall (SYS_futex, parked, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, 
+      NULL, NULL, 0);
+  }
+
+/*============================================================================
+  pwm_time_interrupt
+============================================================================*/
+void pwm_time_interrupt (atomic_int *stop)
+  {
+  atomic_store_explicit (stop, TRUE, memory_order_release);
+  syscall (SYS_futex, stop, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, 
+    NULL, NULL, 0);
+  }
+
+/*============================================================================
+  pwm_time_resync
+============================================================================*/
+int pwm_time_resync (int64_t *cycle_start, int64_t cycle_ns, int64_t now)
+  {
+  if (now < *cycle_start + cycle_ns) return 0;
+  int64_t skipped = (now - *cycle_start) / cycle_ns;
+  *cycle_start += skipped * cycle_ns;
+  return (int)skipped;
+  }
+
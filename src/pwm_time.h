@@ -0,0 +1,74 @@
+/*============================================================================
+  
+  pwm_time.h
+
+  Monotonic clock helpers for the PWM timing loops. Times are held as
+  64-bit nanosecond counts on CLOCK_MONOTONIC, which are easier to do 
+  arithmetic on than struct timespec, and won't overflow for centuries.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define PWM_NSEC_PER_USEC 1000LL
+#define PWM_NSEC_PER_SEC 1000000000LL
+
+// A deadline that never comes, for pwm_time_park()
+#define PWM_TIME_FOREVER INT64_MAX
+
+BEGIN_DECLS
+
+/** Current time on the monotonic clock, in nanoseconds. */
+static inline int64_t pwm_time_now (void)
+  {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * PWM_NSEC_PER_SEC + ts.tv_nsec;
+  }
+
+/** Sleep until the absolute monotonic time deadline, in nanoseconds.
+    Returns at once if the deadline has passed. If spin_ns is non-zero, 
+    only sleep until spin_ns before the deadline, and busy-wait on the 
+    clock for the rest, which avoids the scheduler's wakeup latency at 
+    the cost of keeping the CPU busy for spin_ns per edge. 
+
+    If stop is not NULL, the sleep also ends as soon as *stop is set by
+    pwm_time_interrupt(). Returns FALSE if it ended that way. */
+BOOL     pwm_time_sleep_until (int64_t deadline, int64_t spin_ns,
+           atomic_int *stop);
+
+/** Set *stop, and wake any thread that is sleeping on it in
+    pwm_time_sleep_until(), at once. */
+void     pwm_time_interrupt (atomic_int *stop);
+
+/** Sleep as pwm_time_sleep_until() does, but for as long as *parked is
+    set, as well: the sleep ends, and FALSE is returned, as soon as 
+    pwm_time_unpark() clears it, or *stop is set. With a deadline of 
+    PWM_TIME_FOREVER, nothing else ends it, and spin_ns is ignored. The
+    caller sets *parked before it makes its last check that there is 
+    nothing to do, so that a wakeup after that check isn't missed. Both
+    pwm_time_interrupt() and pwm_time_unpark() must be called to stop a
+    thread that parks. */
+BOOL     pwm_time_park (atomic_int *parked, int64_t deadline, int64_t spin_ns,
+           atomic_int *stop);
+
+/** Clear *parked, and wake the thread parked on it, if there is one.
+    When *parked is already clear, which is nearly always, this costs a
+    memory barrier and a load, and no system call. */
+void     pwm_time_unpark (atomic_int *parked);
+
+/** Advance a cycle start time past "now", by a whole number of 
+    cycles, so that a timeline that has fallen behind picks up again 
+    at the right phase, rather than trying to catch up with a burst of 
+    edges. Returns the number of cycles skipped. */
+int      pwm_time_resync (int64_t *cycle_start, int64_t cycle_ns, 
+           int64_t now);
+
+END_DECLS
+
@@ -0,0 +1,92 @@
+/*==========================================================================
+
+    pwm_trace.c
+
+    Trace points written to the ftrace trace_marker (see pwm_trace.h).
+    Only built with "make TRACE=1". The marker is opened the first time
+    anything is traced; if it can't be -- tracefs isn't mounted, or we
+    can't write to it -- tracing silently does nothing. Each event is one
+    write(), so that it is one record in the trace, and the kernel
+    timestamps it as it goes in.
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#ifdef PWM_TRACE
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "defs.h"
+#include "pwm_trace.h"
+
+// Where tracefs might be mounted, newest first
+static const char *const pwm_trace_markers[] =
+  {
+  "/sys/kernel/tracing/trace_marker",
+  "/sys/kernel/debug/tracing/trace_marker"
+  };
+
+static int pwm_trace_fd = -1;
+static pthread_once_t pwm_trace_once = PTHREAD_ONCE_INIT;
+
+/*============================================================================
+  pwm_trace_open
+============================================================================*/
+static void pwm_trace_open (void)
+  {
+  int n = sizeof (pwm_trace_markers) / sizeof (pwm_trace_markers[0]);
+  for (int i = 0; i < n && pwm_trace_fd < 0; i++)
+    pwm_trace_fd = open (pwm_trace_markers[i], O_WRONLY | O_CLOEXEC);
+  }
+
+/*============================================================================
+  pwm_trace_write
+============================================================================*/
+static __attribute__ ((format (printf, 1, 2))) 
+void pwm_trace_write (const char *fmt, ...)
+  {
+  pthread_once (&pwm_trace_once, pwm_trace_open);
+  if (pwm_trace_fd < 0) return;
+  char buf[128];
+  va_list ap;
+  va_start (ap, fmt);
+  int n = vsnprintf (buf, sizeof (buf), fmt, ap);
+  va_end (ap);
+  if (n > (int)sizeof (buf) - 1) n = sizeof (buf) - 1;
+  ssize_t written = write (pwm_trace_fd, buf, n);
+  written = written; // Suppress warnings
+  }
+
+/*============================================================================
+  pwm_trace_wait
+============================================================================*/
+void pwm_trace_wait (int pin, int64_t due)
+  {
+  pwm_trace_write ("pwm_wait pin=%d due=%lld\n", pin, (long long)due);
+  }
+
+/*============================================================================
+  pwm_trace_wake
+============================================================================*/
+void pwm_trace_wake (int pin, int64_t due, int64_t now)
+  {
+  if (now - due >= PWM_TRACE_LATE_NSEC)
+    pwm_trace_write ("pwm_wake pin=%d late_ns=%lld\n", pin,
+      (long long)(now - due));
+  }
+
+/*============================================================================
+  pwm_trace_edge
+============================================================================*/
+void pwm_trace_edge (int pin, int level, int64_t due, int64_t written)
+  {
+  pwm_trace_write ("pwm_edge pin=%d level=%d late_ns=%lld\n", pin, level,
+    (long long)(written - due));
+  }
+
+#endif
+
@@ -0,0 +1,66 @@
+/*============================================================================
+
+  pwm_trace.h
+
+  Optional trace points in the timing threads, for lining up the PWM's
+  edges with the kernel's scheduling and interrupt events. Build with
+  "make TRACE=1" (after "make clean") to have each one written to the
+  ftrace trace_marker, where trace-cmd, perf (as ftrace:print events),
+  or a read of the trace file shows it among everything else the kernel
+  recorded. Without TRACE=1, the trace points compile to nothing, and
+  their arguments are not evaluated. Not part of the public interface.
+
+  The events are:
+
+  pwm_wait pin=N due=T        the thread is going to sleep until T, the
+                              time of pin N's next edge (pin=-1 for an
+                              engine, which waits for all its pins)
+  pwm_wake pin=N late_ns=L    the thread woke more than
+                              PWM_TRACE_LATE_NSEC after it meant to
+  pwm_edge pin=N level=V late_ns=L
+                              the edge was written L nsec after it was
+                              due
+
+  Times are CLOCK_MONOTONIC nsec, as pwm_time_now() gives.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+#include <stdint.h>
+
+// A wakeup at least this late is traced
+#ifndef PWM_TRACE_LATE_NSEC
+#define PWM_TRACE_LATE_NSEC 50000
+#endif
+
+#ifdef PWM_TRACE
+
+BEGIN_DECLS
+
+void     pwm_trace_wait (int pin, int64_t due);
+void     pwm_trace_wake (int pin, int64_t due, int64_t now);
+void     pwm_trace_edge (int pin, int level, int64_t due, int64_t written);
+
+END_DECLS
+
+#define PWM_TRACE_WAIT(pin, due) pwm_trace_wait (pin, due)
+#define PWM_TRACE_WAKE(pin, due, now) pwm_trace_wake (pin, due, now)
+#define PWM_TRACE_EDGE(pin, level, due, written) \
+  pwm_trace_edge (pin, level, due, written)
+
+#else
+
+// The arguments go inside sizeof, which doesn't evaluate them, only so
+//  that they don't show up as unused
+#define PWM_TRACE_WAIT(pin, due) \
+  do { (void)sizeof ((pin) + (due)); } while (0)
+#define PWM_TRACE_WAKE(pin, due, now) \
+  do { (void)sizeof ((pin) + (due) + (now)); } while (0)
+#define PWM_TRACE_EDGE(pin, level, due, written) \
+  do { (void)sizeof ((pin) + (level) + (due) + (written)); } while (0)
+
+#endif
+
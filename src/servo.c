@@ -0,0 +1,141 @@
+/*==========================================================================
+  
+    servo.c
+
+    Servo positioning with moves that run on the timing thread. The 
+    application says where the servo should go and how long it should 
+    take; the PWM steps the pulse width towards the target each cycle 
+    (see pwm_motion_step()), so motion is as smooth as the PWM frequency 
+    allows, and costs one cross-thread store per move, not one per step.
+
+    Typical calling sequence is:
+
+    PWM *pwm = pwm_create (pin)
+    pwm_start (pwm, SERVO_DEFAULT_CYCLE_USEC, ...)
+    Servo *servo = servo_create (pwm)
+    servo_move_to (servo, 1500, 1000)
+    ...
+    servo_destroy (servo)
+    pwm_stop (pwm)
+    pwm_destroy (pwm)
+
+    Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "defs.h" 
+#include "pwm.h" 
+#include "pwm_internal.h" 
+#include "servo.h" 
+
+struct _Servo
+  {
+  PWM *pwm; // The PWM that drives the servo; not owned
+  int min_usec; // Shortest pulse the servo accepts
+  int max_usec; // Longest pulse the servo accepts
+  int max_rate; // Fastest pulse-width change, in usec/sec, or zero
+  };
+
+/*============================================================================
+  servo_create
+============================================================================*/
+Servo *servo_create (PWM *pwm)
+  {
+  assert (pwm != NULL);
+  Servo *self = malloc (sizeof (Servo));
+  memset (self, 0, sizeof (Servo));
+  self->pwm = pwm;
+  self->min_usec = SERVO_DEFAULT_MIN_USEC;
+  self->max_usec = SERVO_DEFAULT_MAX_USEC;
+  return self;
+  }
+
+/*============================================================================
+  servo_destroy
+============================================================================*/
+void servo_destroy (Servo *self)
+  {
+  free (self);
+  }
+
+/*============================================================================
+  servo_set_range
+============================================================================*/
+void servo_set_range (Servo *self, int min_usec, int max_usec)
+  {
+  assert (self != NULL);
+  assert (min_usec <= max_usec);
+  self->min_usec = min_usec;
+  self->max_usec = max_usec;
+  }
+
+/*============================================================================
+  servo_set_max_rate
+============================================================================*/
+void servo_set_max_rate (Servo *self, int max_usec_per_sec)
+  {
+  assert (self != NULL);
+  self->max_rate = max_usec_per_sec > 0 ? max_usec_per_sec : 0;
+  }
+
+/*============================================================================
+  servo_set_idle_timeout
+============================================================================*/
+void servo_set_idle_timeout (Servo *self, int msec)
+  {
+  assert (self != NULL);
+  pwm_set_idle_timeout (self->pwm, msec);
+  }
+
+/*============================================================================
+  servo_get_pulse_usec
+============================================================================*/
+int servo_get_pulse_usec (const Servo *self)
+  {
+  assert (self != NULL);
+  int on_usec, off_usec;
+  pwm_load_timing (self->pwm, &on_usec, &off_usec);
+  return on_usec;
+  }
+
+/*============================================================================
+  servo_move_to
+============================================================================*/
+void servo_move_to (Servo *self, int target_usec, int duration_msec)
+  {
+  assert (self != NULL);
+  if (target_usec < self->min_usec) target_usec = self->min_usec;
+  if (target_usec > self->max_usec) target_usec = self->max_usec;
+  if (duration_msec < 0) duration_msec = 0;
+
+  // Before the first move the pulse is zero, or it was set outside the
+  //  range some other way; a ramp from there would sweep through pulse
+  //  widths the servo doesn't accept, so start it from the nearest one
+  //  that it does
+  int from_usec = servo_get_pulse_usec (self);
+  if (from_usec < self->min_usec || from_usec > self->max_usec)
+    {
+    from_usec = from_usec < self->min_usec ? self->min_usec : self->max_usec;
+    pwm_set_pulse_usec (self->pwm, from_usec);
+    }
+
+  if (self->max_rate > 0)
+    {
+    int distance = abs (target_usec - from_usec);
+    int64_t min_msec = ((int64_t)distance * 1000 + self->max_rate - 1) 
+      / self->max_rate;
+    if (duration_msec < min_msec) duration_msec = (int)min_msec;
+    }
+
+  int cycle_usec = self->pwm->cycle_usec;
+  int frames = 1;
+  if (cycle_usec > 0)
+    frames = (int)(((int64_t)duration_msec * 1000 + cycle_usec / 2) 
+      / cycle_usec);
+  pwm_move_pulse_usec (self->pwm, target_usec, frames);
+  }
+
@@ -0,0 +1,67 @@
+/*============================================================================
+  
+  servo.h
+
+  Hobby-servo control on top of a PWM instance. The servo's position is
+  its pulse width, and a move from one position to another is ramped
+  by the PWM's timing thread, one step per cycle, rather than by the
+  application calling pwm_set_duty() over and over.
+
+  Copyright (c)1990-2020 Kevin Boone. Distributed under the terms of the
+  GNU Public Licence, v3.0
+
+  ==========================================================================*/
+#pragma once
+
+struct _Servo;
+typedef struct _Servo Servo;
+
+// The pulse range of the common SG90 micro-servo, 0.5 - 2.5 msec, at
+//  its recommended cycle length of 20 msec (50 Hz)
+#define SERVO_DEFAULT_MIN_USEC 500
+#define SERVO_DEFAULT_MAX_USEC 2500
+#define SERVO_DEFAULT_CYCLE_USEC 20000
+
+BEGIN_DECLS
+
+/** Create a servo that is driven by the given PWM instance, with the
+    default pulse range and no rate limit. The PWM may be started, or 
+    added to an engine, before or after this call. The caller still owns
+    the PWM, and should destroy it after the servo. */
+Servo   *servo_create (PWM *pwm);
+
+/** Free the servo. The PWM is not stopped. */
+void     servo_destroy (Servo *self);
+
+/** Set the range of pulse widths, in usec, that the servo accepts. Moves
+    are clamped to this range. */
+void     servo_set_range (Servo *self, int min_usec, int max_usec);
+
+/** Limit the servo's speed to max_usec_per_sec of pulse-width change per
+    second. A move that asks to be faster than this is stretched. Zero, 
+    the default, means no limit. */
+void     servo_set_max_rate (Servo *self, int max_usec_per_sec);
+
+/** Stop pulsing, so that the servo goes limp, once it has gone msec 
+    milliseconds without a move. The next move starts the pulses again.
+    Zero, the default, keeps them going. This is 
+    pwm_set_idle_timeout() on the servo's PWM, so it must be set before
+    that is started. */
+void     servo_set_idle_timeout (Servo *self, int msec);
+
+/** Move the servo to the position given by target_usec, taking 
+    duration_msec to get there. The pulse width is interpolated once per 
+    PWM cycle by the timing thread, so this call returns at once. A new
+    move replaces one in progress, starting from wherever that one has
+    got to. A duration of zero jumps at the next cycle. If the pulse is
+    outside the servo's range -- as it is before the first move -- it is 
+    set straight to the nearest end of the range, and the move starts 
+    from there. */
+void     servo_move_to (Servo *self, int target_usec, int duration_msec);
+
+/** The pulse width, in usec, that the servo is being driven with now,
+    part-way through a move or otherwise. */
+int      servo_get_pulse_usec (const Servo *self);
+
+END_DECLS
+